@@ -1,9 +1,24 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <errno.h>
+#include "clist_port.h"	/* メモリの確保、時刻など（カーネルとユーザ空間で切り替える） */
+
+#ifndef CLIST_PORT_KERNEL
+#include <sys/syscall.h>	/* SYS_futex */
+#include <linux/futex.h>	/* FUTEX_WAIT, FUTEX_WAKE, FUTEX_PRIVATE_FLAG */
+#include <sys/eventfd.h>	/* eventfd() */
+#include <sys/stat.h>	/* fstat() */
+#include <fcntl.h>	/* O_CREAT, O_EXCL */
+#include <sys/uio.h>	/* struct iovec, writev() */
+#if defined(__x86_64__)
+#include <immintrin.h>	/* _mm_stream_si128(), _mm256_loadu_si256() */
+#define CLIST_COPY_X86
+#endif
+#endif	/* CLIST_PORT_KERNEL */
 
+#ifdef __KERNEL__
+#include <linux/clist.h>	/* カーネルのツリーではinclude/linux/に置く */
+#else
 #include "clist.h"
+#endif
+#include "clist_trace.h"
 
 /***********************************
 *
@@ -12,510 +27,3824 @@
 ************************************/
 
 /*
-	循環リストにデータをコピーする関数
-	@src コピーするデータ
-	@len コピーするオブジェクトの個数
+	ノードのデータ領域をまとめて確保する関数
+	@slab_len 確保するバイト数
+	return 成功:確保した領域 失敗:NULL
+
+	隣接したノードをまたぐpush/pullが1回のmemcpyで済み、ハードウェアプリフェッチも効きやすい
+	1ページ以上ならページ境界、それ未満ならキャッシュライン境界に揃える
+*/
+static void *clist_slab_alloc(size_t slab_len)
+{
+	size_t align;
+
+	align = clist_page_size();
+
+	if(slab_len < align){
+		align = CLIST_CACHELINE_SIZE;
+	}
+
+	return clist_aligned_alloc(align, slab_len);
+}
+
+/*
+	オブジェクトのコピー関数の種類（clist_init()でobject_sizeから選び、copy_kindに入れる）
+	8/16/32/64バイトは固定長のコピーを並べ、それ以外とCLIST_COPY_SMALL_MAXバイトを超えるコピーはmemcpyに任せる
+*/
+#define CLIST_COPY_KIND_MEMCPY	0
+#define CLIST_COPY_KIND_8	1
+#define CLIST_COPY_KIND_16	2
+#define CLIST_COPY_KIND_32	3
+#define CLIST_COPY_KIND_64	4
+
+#define CLIST_COPY_SMALL_MAX	256	/* これより大きいコピーはmemcpyの方が速い */
+
+static int clist_cpu_avx = -1;	/* AVXが使えれば1（プロセスごとにclist_copy_setup()で調べる） */
+
+/*
+	CPUの機能を調べてコピー関数を選ぶ関数
 	@clist_ctl 管理構造体のアドレス
 
-	データ長の検査はこの関数内では行っていない この関数内はクリティカルセクション
+	copy_kindはobject_sizeだけで決まるので、共有メモリをattachしたプロセスでも同じ番号になる
+	AVXを使うかどうかは番号ではなくプロセスごとのclist_cpu_avxで決める
 */
-static void clist_wmemcpy(const void *src, int n, struct clist_controller *clist_ctl)
+static void clist_copy_setup(struct clist_controller *clist_ctl)
 {
-	int len;
+#ifdef CLIST_COPY_X86
+	if(clist_cpu_avx < 0){
+		__builtin_cpu_init();
+		clist_cpu_avx = __builtin_cpu_supports("avx") ? 1 : 0;
+	}
+#else
+	clist_cpu_avx = 0;
+#endif
 
-	len = n * clist_ctl->object_size;
+	if(clist_ctl == NULL){
+		return;
+	}
+
+	switch(clist_ctl->object_size){
+	case 8:
+		clist_ctl->copy_kind = CLIST_COPY_KIND_8;
+		break;
+	case 16:
+		clist_ctl->copy_kind = CLIST_COPY_KIND_16;
+		break;
+	case 32:
+		clist_ctl->copy_kind = CLIST_COPY_KIND_32;
+		break;
+	case 64:
+		clist_ctl->copy_kind = CLIST_COPY_KIND_64;
+		break;
+	default:
+		clist_ctl->copy_kind = CLIST_COPY_KIND_MEMCPY;
+		break;
+	}
+
+	/* 1コアしか無ければ消費者も同じコアで読むので、キャッシュを素通りさせると遅くなるだけ */
+	clist_ctl->copy_stream = clist_online_cpus() > 1;
+}
 
-	memcpy(clist_ctl->w_curr->curr_ptr, src, len);
-	clist_ctl->w_curr->curr_ptr += len;
+#ifdef CLIST_COPY_X86
+/*
+	32バイト単位のコピー（AVX）
+	@n 32バイトの塊の数
+*/
+__attribute__((target("avx")))
+static void clist_copy32_avx(void *dest, const void *src, int n)
+{
+	int i;
 
-	if(clist_ctl->w_curr->curr_ptr - clist_ctl->w_curr->data == clist_ctl->node_len){
-		clist_ctl->w_curr = clist_ctl->w_curr->next_node;		/* ノードが一杯になったので、次のノードにアドレスをつなぐ */
-		clist_ctl->pull_wait_length++;
+	for(i = 0; i < n; i++){
+		_mm256_storeu_si256((__m256i *)dest + i, _mm256_loadu_si256((const __m256i *)src + i));
 	}
 }
+#endif
 
 /*
-	循環リストからデータをコピーする関数
+	オブジェクトn個をコピーする関数
 	@dest コピー先のアドレス
-	@len コピーするデータの長さ（バイト）
+	@src コピー元のアドレス
+	@n オブジェクトの個数
 	@clist_ctl 管理構造体のアドレス
 
-	データ長の検査はこの関数内では行っていない この関数内はクリティカルセクション
+	固定長のmemcpyはコンパイラが8/16バイトのmovに展開する 32/64バイトはAVXが使えればymmレジスタで運ぶ
 */
-static void clist_rmemcpy(void *dest, int n, struct clist_controller *clist_ctl)
+static inline void clist_copy_objs(void *dest, const void *src, int n, const struct clist_controller *clist_ctl)
 {
-	int len;
-	void *seek_head;
+	int i;
+
+	if(objs_to_byte(clist_ctl, n) > CLIST_COPY_SMALL_MAX){
+		memcpy(dest, src, objs_to_byte(clist_ctl, n));
+		return;
+	}
+
+	switch(clist_ctl->copy_kind){
+	case CLIST_COPY_KIND_8:
+		for(i = 0; i < n; i++){
+			memcpy(dest + i * 8, src + i * 8, 8);
+		}
+		break;
+	case CLIST_COPY_KIND_16:
+		for(i = 0; i < n; i++){
+			memcpy(dest + i * 16, src + i * 16, 16);
+		}
+		break;
+	case CLIST_COPY_KIND_32:
+	case CLIST_COPY_KIND_64:
+#ifdef CLIST_COPY_X86
+		if(clist_cpu_avx){
+			clist_copy32_avx(dest, src, objs_to_byte(clist_ctl, n) / 32);
+			break;
+		}
+#endif
+		for(i = 0; i < objs_to_byte(clist_ctl, n) / 16; i++){
+			memcpy(dest + i * 16, src + i * 16, 16);
+		}
+		break;
+	default:
+		memcpy(dest, src, objs_to_byte(clist_ctl, n));
+		break;
+	}
+}
+
+/*
+	copy_policyに従ってオブジェクトn個をコピーする関数
+	@dest コピー先のアドレス
+	@src コピー元のアドレス
+	@n オブジェクトの個数
+	@clist_ctl 管理構造体のアドレス
+*/
+static inline void clist_copy(void *dest, const void *src, int n, const struct clist_controller *clist_ctl)
+{
+	if(clist_ctl->copy_policy == CLIST_COPY_MEMCPY){
+		memcpy(dest, src, objs_to_byte(clist_ctl, n));
+	}
+	else{
+		clist_copy_objs(dest, src, n, clist_ctl);
+	}
+}
+
+/*
+	ノード単位の書き込みをキャッシュを通さずにコピーする関数
+	@dest コピー先のアドレス（ノードのデータ領域）
+	@src コピー元のアドレス
+	@len コピーするバイト数
+
+	生産者のキャッシュを次に読まれるまで使わないデータで埋めないように、non-temporalストアで書く
+	ストアの順番は保証されないので、最後にsfenceしてからw_seqを公開すること
+*/
+static void clist_stream_copy(void *dest, const void *src, size_t len)
+{
+#ifdef CLIST_COPY_X86
+	size_t head;
 
-	len = n * clist_ctl->object_size;
+	head = (size_t)(-(uintptr_t)dest & 15);	/* 16バイト境界まではmemcpy */
+
+	if(head > len){
+		head = len;
+	}
 
-	/* curr_ptrとdataから読み出すアドレスを計算する */
-	seek_head = clist_ctl->r_curr->data + clist_ctl->node_len - (clist_ctl->r_curr->curr_ptr - clist_ctl->r_curr->data);
+	memcpy(dest, src, head);
+	dest += head;
+	src += head;
+	len -= head;
 
-	memcpy(dest, seek_head, len);
-	clist_ctl->r_curr->curr_ptr -= len;
+	for(; len >= 64; len -= 64, dest += 64, src += 64){
+		_mm_stream_si128((__m128i *)dest, _mm_loadu_si128((const __m128i *)src));
+		_mm_stream_si128((__m128i *)dest + 1, _mm_loadu_si128((const __m128i *)src + 1));
+		_mm_stream_si128((__m128i *)dest + 2, _mm_loadu_si128((const __m128i *)src + 2));
+		_mm_stream_si128((__m128i *)dest + 3, _mm_loadu_si128((const __m128i *)src + 3));
+	}
 
-	if(clist_ctl->r_curr->curr_ptr - clist_ctl->r_curr->data == 0){
-		clist_ctl->r_curr = clist_ctl->r_curr->next_node;		/* w_currにノード1つ分だけ近づける */
-		clist_ctl->pull_wait_length--;
+	for(; len >= 16; len -= 16, dest += 16, src += 16){
+		_mm_stream_si128((__m128i *)dest, _mm_loadu_si128((const __m128i *)src));
 	}
+
+	memcpy(dest, src, len);
+	_mm_sfence();
+#else
+	memcpy(dest, src, len);
+#endif
 }
 
-/***********************************
-*
-*		公開用関数
-*
-************************************/
+/*
+	ノード単位の書き込みをnon-temporalストアにするかどうかを返す関数
+	@len まとめて書き込むバイト数
+	@clist_ctl 管理構造体のアドレス
+*/
+static inline int clist_use_stream(size_t len, const struct clist_controller *clist_ctl)
+{
+	if(clist_ctl->copy_policy == CLIST_COPY_STREAM){
+		return 1;
+	}
+
+	return clist_ctl->copy_policy == CLIST_COPY_AUTO && clist_ctl->copy_stream && len >= CLIST_COPY_STREAM_MIN;
+}
 
 /*
-	read可能なデータのサイズを返す関数
+	生産者側の統計に加算する関数
+	@counter clist_ctl->wstatsのメンバのアドレス
+	@v 加算する値
+	@clist_ctl 管理構造体のアドレス
+
+	MPSCモードでは生産者同士で同じカウンタを書くのでアトミックに加算し、それ以外は自分しか書かないので読んで書くだけにする
+*/
+static inline void clist_wstat_add(unsigned long long *counter, unsigned long long v, const struct clist_controller *clist_ctl)
+{
+	if(clist_ctl->mode & CLIST_MODE_MPSC){
+		clist_add_relaxed(counter, v);
+	}
+	else{
+		clist_store_relaxed(counter, clist_load_relaxed(counter) + v);
+	}
+}
+
+/*
+	消費者側の統計に加算する関数
+	@counter clist_ctl->rstatsのメンバのアドレス
+	@v 加算する値
+*/
+static inline void clist_rstat_add(unsigned long long *counter, unsigned long long v)
+{
+	clist_store_relaxed(counter, clist_load_relaxed(counter) + v);
+}
+
+/*
+	pushで要求した分を全部は書けなかったら数える関数（pushのトレースポイントも兼ねる）
+	@n 要求したオブジェクトの個数
+	@ret pushの戻り値
+	@clist_ctl 管理構造体のアドレス
+	return retをそのまま返す
+*/
+static inline int clist_count_partial(int n, int ret, struct clist_controller *clist_ctl)
+{
+	clist_trace(CLIST_TRACE_PUSH, clist_ctl, n, ret);
+
+	if((ret >= 0 && ret < n) || ret == -EAGAIN){
+		clist_wstat_add(&clist_ctl->wstats.partial, 1, clist_ctl);
+	}
+
+	return ret;
+}
+
+/*
+	pullの結果を記録する関数（pullのトレースポイント）
+	@n 要求したオブジェクトの個数
+	@ret pullの戻り値
+	@clist_ctl 管理構造体のアドレス
+	return retをそのまま返す
+*/
+static inline int clist_pull_done(int n, int ret, const struct clist_controller *clist_ctl)
+{
+	clist_trace(CLIST_TRACE_PULL, clist_ctl, n, ret);
+
+	if(ret == 0 && n > 0){
+		clist_trace(CLIST_TRACE_EMPTY, clist_ctl, n, 0);
+	}
+
+	return ret;
+}
+
+/*
+	最後にCOLDになってからの時間（ナノ秒）を返す関数
+*/
+static inline unsigned long long clist_cold_elapsed(const struct clist_controller *clist_ctl)
+{
+	long long ns;
+
+	ns = clist_now_ns() - clist_load_relaxed(&clist_ctl->wstats.cold_since);
+
+	return ns > 0 ? (unsigned long long)ns : 0;
+}
+
+/*
+	消費者側から見たpull待ちのノード数を返す関数
+	r_seqは消費者だけが更新するのでrelaxedで読み、w_seqはacquireで読んでノードの中身を見えるようにする
+*/
+static inline int clist_ready_nodes(const struct clist_controller *clist_ctl)
+{
+	return (int)(clist_load_acquire(&clist_ctl->w_seq) - clist_load_relaxed(&clist_ctl->r_seq));
+}
+
+/*
+	生産者側から見た書き込み済み（まだpullされていない）ノード数を返す関数
+	w_seqは生産者だけが更新するのでrelaxedで読み、r_seqはacquireで読んで消費者の読み込み完了を確認する
+*/
+static inline int clist_filled_nodes(const struct clist_controller *clist_ctl)
+{
+	return (int)(clist_load_relaxed(&clist_ctl->w_seq) - clist_load_acquire(&clist_ctl->r_seq));
+}
+
+/*
+	pushしてよいかを判定する関数
+	@clist_ctl 管理構造体のアドレス
+	@write_scope clist_pushable_objects()で求めたwrite可能なオブジェクトの個数
+	return push可能:1 push禁止:0
+
+	COLDは生産者が循環リストが満杯だったことを記録しているだけなので、消費者が既にノードを空けていればHOTに戻す
+	（消費者がHOTに戻した直後に生産者がCOLDを書き込むと、誰もHOTに戻さなくなるため）
+*/
+static int clist_push_permitted(struct clist_controller *clist_ctl, int write_scope)
+{
+	if(!CLIST_IS_COLD(clist_ctl)){
+		return 1;
+	}
+
+	if(write_scope > 0){
+		if(clist_cmpxchg(&clist_ctl->state, CLIST_STATE_COLD, CLIST_STATE_HOT)){
+			clist_trace(CLIST_TRACE_HOT, clist_ctl, 0, 0);
+			clist_wstat_add(&clist_ctl->wstats.full_ns, clist_cold_elapsed(clist_ctl), clist_ctl);
+		}
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+	循環リストを生産者側からpush禁止に設定する関数
+	END状態を上書きしないようにHOTの時だけCOLDにする
+
+	HOTに戻した側がCOLDだった時間を数えられるように、COLDにする前に時刻を残す
+*/
+static inline void clist_set_cold(struct clist_controller *clist_ctl)
+{
+	if(!CLIST_IS_HOT(clist_ctl)){
+		return;
+	}
+
+	clist_store_relaxed(&clist_ctl->wstats.cold_since, clist_now_ns());
+
+	if(clist_cmpxchg(&clist_ctl->state, CLIST_STATE_HOT, CLIST_STATE_COLD)){
+		clist_trace(CLIST_TRACE_FULL, clist_ctl, clist_wlen(clist_ctl), 0);
+		clist_wstat_add(&clist_ctl->wstats.cold, 1, clist_ctl);
+	}
+}
+
+/*
+	循環リストを消費者側からpush許可に設定する関数
+*/
+static inline void clist_set_hot(struct clist_controller *clist_ctl)
+{
+	if(!CLIST_IS_COLD(clist_ctl)){
+		return;	/* pullのたびにCASでstateのキャッシュラインを奪わないように、まず読むだけにする */
+	}
+
+	if(clist_cmpxchg(&clist_ctl->state, CLIST_STATE_COLD, CLIST_STATE_HOT)){
+		clist_trace(CLIST_TRACE_HOT, clist_ctl, 1, 0);
+		clist_rstat_add(&clist_ctl->rstats.full_ns, clist_cold_elapsed(clist_ctl));
+	}
+}
+
+#ifndef CLIST_PORT_KERNEL
+/*
+	futexの操作にPRIVATEを付けるか決める関数
+	共有メモリの循環リストは別プロセスのスレッドも寝ているので、プロセス間で使えるfutexにする
+*/
+static inline int clist_futex_op(int op, const struct clist_controller *clist_ctl)
+{
+	return clist_ctl->shared ? op : (op | FUTEX_PRIVATE_FLAG);
+}
+
+/*
+	futexで寝ているスレッドを全て起こす関数
+	@futex_word 寝ているアドレス（r_futexかw_futex）
 	@clist_ctl 管理用構造体のアドレス
-	@n_first ノードに残っているバイト数を格納する関数（任意）
-	@n_burst ノード丸ごと読む場合、いくつのノードか（任意）
-	return read可能なオブジェクトの個数
 
-	※現在書き込み中のノードはread対象にはならない
+	値を変えてから起こすので、寝る直前に値を読んだスレッドはFUTEX_WAITですぐに戻る
 */
-int clist_pullable_objects(const struct clist_controller *clist_ctl, int *n_first, int *n_burst)
+static void clist_futex_wake(int *futex_word, const struct clist_controller *clist_ctl)
 {
-	int first, burst;
+	clist_add_return(futex_word, 1);
+	syscall(SYS_futex, futex_word, clist_futex_op(FUTEX_WAKE, clist_ctl), INT_MAX, NULL, NULL, 0);
+}
 
-	if(clist_ctl->pull_wait_length == 0){
-		first = 0;
-		burst = 0;
+/*
+	eventfdに通知を書き込む関数
+	@fd clist_get_readable_fd()/clist_get_writable_fd()で作ったeventfd
+*/
+static void clist_eventfd_signal(int fd)
+{
+	uint64_t one = 1;
+
+	if(write(fd, &one, sizeof(one)) < 0){
+		;	/* カウンタが溢れている（誰も読んでいない）ので通知済みとみなす */
 	}
-	else if(clist_ctl->pull_wait_length >= 1){
-			/* 読み残しのバイト数を計算 */
-			first = (clist_ctl->r_curr->curr_ptr - clist_ctl->r_curr->data) / clist_ctl->object_size;
+}
+#else
+/*
+	カーネル版にはfutexで寝るスレッドもeventfdも無い（r_waiters/w_waitersは0、rd_fd/wr_fdは-1のまま）
+	通知する側はそのまま残し、ここで何もしない
+*/
+static inline void clist_futex_wake(int *futex_word, const struct clist_controller *clist_ctl)
+{
+	(void)futex_word;
+	(void)clist_ctl;
+}
+
+static inline void clist_eventfd_signal(int fd)
+{
+	(void)fd;
+}
+#endif	/* CLIST_PORT_KERNEL */
 
-		if(first > 0){
+/*
+	pull待ちのノード数がrd_mark以上ならreadable fdに通知する関数
+	@clist_ctl 管理構造体のアドレス
 
-			if(first == clist_ctl->node_len){
-				first = 0;
-				burst = clist_ctl->pull_wait_length;
-			}
-			else{
-				/* 読み残しの分もsub_nodeに含まれているので1を引く */
-				burst = clist_ctl->pull_wait_length - 1;
-			}
+	通知するのはrd_armedが立っている時だけで、通知したらrd_armedを下ろす
+	（消費者がrd_mark未満まで読んだ時に再び立てるので、rd_markをまたぐたびに1回だけ通知される）
+*/
+static void clist_signal_readable(struct clist_controller *clist_ctl)
+{
+	if(clist_wlen(clist_ctl) >= clist_ctl->rd_mark && clist_load_relaxed(&clist_ctl->rd_armed)){
+		if(clist_cmpxchg(&clist_ctl->rd_armed, 1, 0)){
+			clist_eventfd_signal(clist_ctl->rd_fd);
 		}
-		else{	/* 読み残し無し *first == 0 */
-			burst = clist_ctl->pull_wait_length;
+	}
+}
+
+/*
+	pull待ちのノード数がwr_mark以下ならwritable fdに通知する関数
+	@clist_ctl 管理構造体のアドレス
+*/
+static void clist_signal_writable(struct clist_controller *clist_ctl)
+{
+	if(clist_wlen(clist_ctl) <= clist_ctl->wr_mark && clist_load_relaxed(&clist_ctl->wr_armed)){
+		if(clist_cmpxchg(&clist_ctl->wr_armed, 1, 0)){
+			clist_eventfd_signal(clist_ctl->wr_fd);
 		}
 	}
+}
 
-#ifdef DEBUG
-	printf("clist_pullable_objects pull_wait_length:%d first:%d n_burst:%d\n", clist_ctl->pull_wait_length, first, burst);
-#endif
+/*
+	pull待ちのノード数がrd_mark未満に戻ったらreadable fdの通知を再び有効にする関数（消費者側）
+	@clist_ctl 管理構造体のアドレス
 
-	/* NULLでなかったら引数のアドレスに代入 */
-	if(n_first){
-		*n_first = first;
+	有効にした直後に生産者がrd_markまで書き進めていたら、見逃さないように自分で通知する
+*/
+static void clist_rearm_readable(struct clist_controller *clist_ctl)
+{
+	if(!clist_load_relaxed(&clist_ctl->rd_armed) && clist_wlen(clist_ctl) < clist_ctl->rd_mark){
+		clist_store_mb(&clist_ctl->rd_armed, 1);
+		clist_signal_readable(clist_ctl);
 	}
-	if(n_burst){
-		*n_burst = burst;
+}
+
+/*
+	pull待ちのノード数がwr_markを超えたらwritable fdの通知を再び有効にする関数（生産者側）
+	@clist_ctl 管理構造体のアドレス
+*/
+static void clist_rearm_writable(struct clist_controller *clist_ctl)
+{
+	if(!clist_load_relaxed(&clist_ctl->wr_armed) && clist_wlen(clist_ctl) > clist_ctl->wr_mark){
+		clist_store_mb(&clist_ctl->wr_armed, 1);
+		clist_signal_writable(clist_ctl);
+	}
+}
+
+/*
+	ノードが完成したことを消費者に知らせる関数
+	@clist_ctl 管理構造体のアドレス
+
+	clist_pull_wait()で寝ている消費者を起こし、readable fdがあればrd_markをまたいだ時に通知する
+	消費者はr_waiters（rd_armed）を書いてからw_seqを読むので、w_seqの更新とそれらの読み込みの間にフェンスを置く
+	誰も寝ていなければシステムコールは呼ばない pull待ちのノード数の最大値もここで更新する
+*/
+static inline void clist_notify_pull(struct clist_controller *clist_ctl)
+{
+	int wait_length, max;
+
+	clist_fence();
+
+	wait_length = clist_wlen(clist_ctl);
+	max = clist_load_relaxed(&clist_ctl->wstats.max_wait_length);
+
+	while(wait_length > max && !clist_try_cmpxchg(&clist_ctl->wstats.max_wait_length, &max, wait_length)){
+		;	/* MPSCモードで他の生産者に先に更新されたらやり直す */
 	}
 
-	return first + (burst * clist_ctl->nr_composed);
+	if(clist_load_relaxed(&clist_ctl->r_waiters)){
+		clist_futex_wake(&clist_ctl->r_futex, clist_ctl);
+	}
+
+	if(clist_load_relaxed(&clist_ctl->rd_fd) >= 0){
+		clist_signal_readable(clist_ctl);
+	}
+
+	if(clist_load_relaxed(&clist_ctl->wr_fd) >= 0){
+		clist_rearm_writable(clist_ctl);
+	}
 }
 
 /*
-	write可能なデータのサイズを返す関数
-	@clist_ctl 管理用構造体のアドレス
-	@n_first ノードに残っているバイト数を格納する関数（任意）
-	@n_burst ノード丸ごと読む場合、いくつのノードか（任意）
-	return write可能なオブジェクトの個数
+	ノードが空いたことを生産者に知らせる関数
+	@clist_ctl 管理構造体のアドレス
+
+	clist_push_wait()で寝ている生産者を起こし、writable fdがあればwr_markをまたいだ時に通知する
+*/
+static inline void clist_notify_push(struct clist_controller *clist_ctl)
+{
+	clist_fence();
+
+	if(clist_load_relaxed(&clist_ctl->w_waiters)){
+		clist_futex_wake(&clist_ctl->w_futex, clist_ctl);
+	}
+
+	if(clist_load_relaxed(&clist_ctl->wr_fd) >= 0){
+		clist_signal_writable(clist_ctl);
+	}
+
+	if(clist_load_relaxed(&clist_ctl->rd_fd) >= 0){
+		clist_rearm_readable(clist_ctl);
+	}
+}
+
+#ifndef CLIST_PORT_KERNEL
+/*
+	condが成り立たない間futexで寝る関数
+	@futex_word 寝るアドレス
+	@waiters 寝ているスレッドの数
+	@deadline タイムアウトする時刻（CLOCK_MONOTONIC）、NULLなら無制限
+	@cond 寝なくてよいかを判定する関数
+	@clist_ctl 管理構造体のアドレス
+	return 起こされた（または寝る必要が無かった）:0 タイムアウト:-ETIMEDOUT
+*/
+static int clist_futex_wait(int *futex_word, int *waiters, const struct timespec *deadline,
+				int (*cond)(struct clist_controller *), struct clist_controller *clist_ctl)
+{
+	int val;
+	struct timespec now, rel, *timeout = NULL;
+
+	if(deadline){
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		rel.tv_sec = deadline->tv_sec - now.tv_sec;
+		rel.tv_nsec = deadline->tv_nsec - now.tv_nsec;
+
+		if(rel.tv_nsec < 0){
+			rel.tv_sec--;
+			rel.tv_nsec += 1000000000L;
+		}
+
+		if(rel.tv_sec < 0){
+			return -ETIMEDOUT;
+		}
+
+		timeout = &rel;
+	}
+
+	/* 値を読んでから寝ることを宣言し、もう一度条件を確かめてから寝る */
+	val = clist_load_acquire(futex_word);
+	clist_add_return(waiters, 1);
+	clist_fence();
+
+	if(!cond(clist_ctl)){
+		syscall(SYS_futex, futex_word, clist_futex_op(FUTEX_WAIT, clist_ctl), val, timeout, NULL, 0);
+	}
+
+	clist_add_return(waiters, -1);
+
+	return 0;
+}
+
+/*
+	pullできるノードがあるか、ENDになっていれば1を返す関数（clist_futex_wait()の条件）
+*/
+static int clist_pull_ready(struct clist_controller *clist_ctl)
+{
+	return clist_ready_nodes(clist_ctl) > 0 || CLIST_IS_END(clist_ctl);
+}
+
+/*
+	clist_pull_ready()に加えて、寝る時間を決めた後で生産者がw_currを開いていたら1を返す関数（clist_pull_wait()の条件）
+*/
+static int clist_pull_ready_open(struct clist_controller *clist_ctl)
+{
+	return clist_pull_ready(clist_ctl) || (clist_ctl->flush_ns && clist_load_relaxed(&clist_ctl->w_open) != clist_ctl->r_open);
+}
+
+/*
+	pushできる空きがあるか、ENDになっていれば1を返す関数（clist_futex_wait()の条件）
+*/
+static int clist_push_ready(struct clist_controller *clist_ctl)
+{
+	return clist_pushable_objects(clist_ctl, NULL, NULL) > 0 || CLIST_IS_END(clist_ctl);
+}
+#endif	/* CLIST_PORT_KERNEL */
+
+/*
+	nodeから始まって、データ領域がメモリ上で隣接しているノードの数を返す関数
+	@node 先頭のノード
+	@max 数える上限
+	@clist_ctl 管理構造体のアドレス
+
+	slabの末尾で先頭に戻るところでは隣接が切れる
+*/
+static int clist_adjacent_nodes(const struct clist_node *node, int max, const struct clist_controller *clist_ctl)
+{
+	int run = 1;
+
+	while(run < max && clist_next(clist_ctl, node)->data == node->data + clist_ctl->node_len){
+		node = clist_next(clist_ctl, node);
+		run++;
+	}
+
+	return run;
+}
+
+/*
+	空きノードのデータ領域のうち、ページ丸ごと含まれている部分をカーネルに返す関数
+	@node 先頭のノード
+	@nr_nodes ノードの個数（next_nodeでたどる）
+	@clist_ctl 管理構造体のアドレス
+
+	メモリ上で隣接しているノードはまとめて扱い、他のノードと共有しているページには触らない
+	返したページは次に書き込んだ時にカーネルがゼロページを割り当て直すので、呼び出し側で元に戻す必要は無い
+*/
+static void clist_release_pages(struct clist_node *node, int nr_nodes, const struct clist_controller *clist_ctl)
+{
+	int run;
+	uintptr_t page, start, end;
+
+	page = (uintptr_t)clist_page_size();
+
+	while(nr_nodes > 0){
+		run = clist_adjacent_nodes(node, nr_nodes, clist_ctl);
+
+		start = ((uintptr_t)clist_at(clist_ctl, node->data) + page - 1) & ~(page - 1);
+		end = ((uintptr_t)clist_at(clist_ctl, node->data) + (uintptr_t)run * clist_ctl->node_len) & ~(page - 1);
+
+		if(start < end){
+			clist_discard_pages((void *)start, end - start);
+		}
+
+		while(run-- > 0){
+			node = clist_next(clist_ctl, node);
+			nr_nodes--;
+		}
+	}
+}
+
+/*
+	shrink policyで、pull待ちのノード数が少ない状態が続いたらw_currの直後の空きノードを外す関数
+	@clist_ctl 管理構造体のアドレス
+
+	ノードを書き終えるたびに生産者側から呼び出す shrink_periodノード書く間のpull待ちのノード数の最大値を見て、
+	その2倍に2ノード（書き込み中と読み込み中）を足した数（min_node未満にはしない）まで縮める
+	w_currの次のノードは、w_currを書き終えて公開するまで消費者がたどらないので、clist_grow()と同じく消費者を止めずにつなぎ変えられる
+	外したノードはspareに置いてページを返し、clist_grow()が先に使う
+*/
+static void clist_shrink(struct clist_controller *clist_ctl)
+{
+	int i, wait_length, target, nr_cut;
+	struct clist_node *first, *last;
+
+	wait_length = clist_filled_nodes(clist_ctl);
+
+	if(wait_length > clist_ctl->shrink_peak){
+		clist_ctl->shrink_peak = wait_length;
+	}
+
+	if(++clist_ctl->shrink_count < clist_ctl->shrink_period){
+		return;
+	}
+
+	target = clist_ctl->shrink_peak * 2 + 2;
+
+	if(target < clist_ctl->min_node){
+		target = clist_ctl->min_node;
+	}
+
+	clist_ctl->shrink_count = 0;
+	clist_ctl->shrink_peak = 0;
+
+	/* 外せるのはw_curr以外の空きノードだけ（消費者が読み進めれば増えるだけなので、少なめに数えても問題無い） */
+	nr_cut = clist_ctl->nr_node - target;
+
+	if(nr_cut > clist_ctl->nr_node - wait_length - 1){
+		nr_cut = clist_ctl->nr_node - wait_length - 1;
+	}
+
+	if(nr_cut <= 0){
+		return;
+	}
+
+	first = clist_next(clist_ctl, clist_wnode(clist_ctl));
+
+	for(last = first, i = 1; i < nr_cut; i++){
+		last = clist_next(clist_ctl, last);
+	}
+
+	clist_wnode(clist_ctl)->next_node = last->next_node;	/* w_currの直後から外す */
+	clist_store_release(&clist_ctl->nr_node, clist_ctl->nr_node - nr_cut);
+
+	clist_release_pages(first, nr_cut, clist_ctl);
+
+	last->next_node = clist_ctl->spare;
+	clist_ctl->spare = clist_off(clist_ctl, first);
+	clist_ctl->nr_spare += nr_cut;
+}
+
+/*
+	nr_new個のノードとデータ領域を新しく確保する関数
+	@nr_new 確保するノードの個数
+	@clist_ctl 管理構造体のアドレス
+	return 成功:確保した塊（ノードはnext_nodeで順につながっていて、最後のノードのnext_nodeは0） 失敗:NULL
+*/
+static struct clist_chunk *clist_chunk_alloc(int nr_new, struct clist_controller *clist_ctl)
+{
+	int i;
+	struct clist_chunk *chunk;
+
+	chunk = (struct clist_chunk *)clist_zalloc(sizeof(struct clist_chunk) + nr_new * sizeof(struct clist_node));
+
+	if(chunk == NULL){
+		return NULL;
+	}
+
+	chunk->slab = clist_slab_alloc((size_t)nr_new * clist_ctl->node_len);
+
+	if(chunk->slab == NULL){
+		clist_mfree(chunk);
+		return NULL;
+	}
+
+	for(i = 0; i < nr_new; i++){
+		chunk->nodes[i].data = clist_off(clist_ctl, chunk->slab + (size_t)i * clist_ctl->node_len);
+		chunk->nodes[i].curr_ptr = chunk->nodes[i].data;
+		chunk->nodes[i].fill = clist_ctl->node_len;
+		chunk->nodes[i].next_node = (i < nr_new - 1) ? clist_off(clist_ctl, &chunk->nodes[i + 1]) : 0;
+	}
+
+	chunk->next = clist_ctl->chunks;
+	clist_ctl->chunks = chunk;
+
+	return chunk;
+}
+
+/*
+	growth policyで、これからn個書き込むと循環リストが満杯になるならw_currの直後にノードを足す関数
+	@n 書き込もうとしているオブジェクトの個数
+	@clist_ctl 管理構造体のアドレス
+	return 足したノードの数
+
+	w_currの次のノードは、w_currを書き終えてw_seqをreleaseで公開するまで消費者がたどらないので、
+	w_currがまだ生産者のものであるうちに（満杯になる前に）つなぎ変えれば読み込み中の消費者を止めずに済む
+	満杯になってしまった後はw_currがr_currと同じノードなので足さない（上限に達した時と同じくCOLDになる）
+	clist_shrink()で外したノードがあれば、新しく確保する前にそれを使う
+*/
+static int clist_grow(int n, struct clist_controller *clist_ctl)
+{
+	int write_scope, nr_new, nr_reuse;
+	struct clist_chunk *chunk;
+	struct clist_node *node;
+
+	if(clist_ctl->nr_node >= clist_ctl->max_node){
+		return 0;
+	}
+
+	write_scope = clist_pushable_objects(clist_ctl, NULL, NULL);
+
+	if(write_scope == 0 || n < write_scope){
+		return 0;
+	}
+
+	/* n個書いた後も1ノード分は空いているようにする */
+	nr_new = (n - write_scope) / clist_ctl->nr_composed + 1;
+
+	if(nr_new > clist_ctl->max_node - clist_ctl->nr_node){
+		nr_new = clist_ctl->max_node - clist_ctl->nr_node;
+	}
+
+	/* 外しておいたノードを1つずつw_currの直後につなぐ */
+	for(nr_reuse = 0; nr_reuse < nr_new && clist_ctl->spare; nr_reuse++){
+		node = clist_node_at(clist_ctl, clist_ctl->spare);
+		clist_ctl->spare = node->next_node;
+		clist_ctl->nr_spare--;
+
+		node->curr_ptr = node->data;
+		node->next_node = clist_wnode(clist_ctl)->next_node;
+		clist_wnode(clist_ctl)->next_node = clist_off(clist_ctl, node);
+	}
+
+	nr_new -= nr_reuse;
+
+	if(nr_new > 0){
+		chunk = clist_chunk_alloc(nr_new, clist_ctl);
+
+		if(chunk){
+			chunk->nodes[nr_new - 1].next_node = clist_wnode(clist_ctl)->next_node;
+			clist_wnode(clist_ctl)->next_node = clist_off(clist_ctl, &chunk->nodes[0]);	/* w_currの直後につなぐ */
+		}
+		else{	/* 足せなければ今まで通りCOLDにする */
+			nr_new = 0;
+		}
+	}
+
+	clist_store_release(&clist_ctl->nr_node, clist_ctl->nr_node + nr_reuse + nr_new);
+
+	return nr_reuse + nr_new;
+}
+
+/*
+	LATENCYモードで、封をしたノードに時刻を書く関数
+	@node 封をしたノード
+	@clist_ctl 管理構造体のアドレス
+
+	消費者はw_seqをacquireで読んでからstampを読むので、ノードを公開する前に呼ぶこと
+*/
+static inline void clist_lat_stamp(struct clist_node *node, const struct clist_controller *clist_ctl)
+{
+	if(clist_ctl->mode & CLIST_MODE_LATENCY){
+		clist_store_relaxed(&node->stamp, clist_now_ns());
+	}
+}
+
+/*
+	経過時間（ナノ秒）からヒストグラムのバケット番号を求める関数
+	2の累乗の区間を最上位ビットで選び、その下のCLIST_LAT_SUB_BITSビットで区間の中を分ける
+*/
+static inline int clist_lat_bucket(unsigned long long ns)
+{
+	int msb;
+
+	if(ns < (1ULL << CLIST_LAT_SUB_BITS)){
+		return (int)ns;
+	}
+
+	msb = 63 - __builtin_clzll(ns);
+
+	if(msb >= CLIST_LAT_MAX_BITS){
+		return CLIST_LAT_NR_BUCKETS - 1;
+	}
+
+	return ((msb - CLIST_LAT_SUB_BITS + 1) << CLIST_LAT_SUB_BITS)
+		+ (int)((ns >> (msb - CLIST_LAT_SUB_BITS)) & ((1 << CLIST_LAT_SUB_BITS) - 1));
+}
+
+/*
+	LATENCYモードで、読み切ったノードが循環リストにいた時間をヒストグラムに数える関数
+	@stamp ノードに封をした時刻
+	@clist_ctl 管理構造体のアドレス
+
+	ヒストグラムを書くのは消費者だけなので、アトミックな加算は要らない
+*/
+static void clist_lat_record(long long stamp, struct clist_controller *clist_ctl)
+{
+	long long ns;
+	unsigned long long *count;
+
+	ns = clist_now_ns() - stamp;
+
+	count = &clist_ctl->lat_hist[clist_lat_bucket(ns > 0 ? (unsigned long long)ns : 0)];
+	clist_store_relaxed(count, clist_load_relaxed(count) + 1);
+}
+
+/*
+	w_currに封をして消費者に公開し、次のノードに進む関数
+	@clist_ctl 管理構造体のアドレス
+
+	w_currは生産者だけが触るので、w_seqをreleaseで公開すればロックは要らない
+	書き込んだバイト数をfillに残すので、ノードが一杯になる前にも封をできる（VARLENモードとclist_flush()）
+	その時はw_partialも数えて、消費者にノード単位のまとめ読みができないことを知らせる
+*/
+static void clist_wseal(struct clist_controller *clist_ctl)
+{
+	clist_wnode(clist_ctl)->fill = clist_wnode(clist_ctl)->curr_ptr - clist_wnode(clist_ctl)->data;
+
+	if(clist_wnode(clist_ctl)->fill != clist_ctl->node_len){
+		clist_store_relaxed(&clist_ctl->w_partial, clist_ctl->w_partial + 1);	/* w_seqのreleaseより前に書く */
+	}
+
+	clist_store_relaxed(&clist_ctl->w_open, 0);	/* 消費者もclist_rseal()で読む */
+	clist_lat_stamp(clist_wnode(clist_ctl), clist_ctl);
+	clist_ctl->w_curr = clist_wnode(clist_ctl)->next_node;		/* 次のノードにアドレスをつなぐ */
+	clist_wnode(clist_ctl)->curr_ptr = clist_wnode(clist_ctl)->data;	/* 前の周回の書き込み位置を消す（消費者はcurr_ptrを見ない） */
+	clist_store_release(&clist_ctl->w_seq, clist_ctl->w_seq + 1);	/* ノードの中身を消費者に公開する */
+	clist_notify_pull(clist_ctl);
+
+	if(clist_ctl->shrink_period){
+		clist_shrink(clist_ctl);
+	}
+}
+
+/*
+	w_currの書き込み位置をオブジェクトn個分だけ進める関数
+	@n 進めるオブジェクトの個数
+	@clist_ctl 管理構造体のアドレス
+*/
+static void clist_wadvance(int n, struct clist_controller *clist_ctl)
+{
+	clist_wnode(clist_ctl)->curr_ptr += objs_to_byte(clist_ctl, n);
+
+	clist_wstat_add(&clist_ctl->wstats.objects, n, clist_ctl);
+	clist_wstat_add(&clist_ctl->wstats.bytes, objs_to_byte(clist_ctl, n), clist_ctl);
+
+	if(clist_wnode(clist_ctl)->curr_ptr - clist_wnode(clist_ctl)->data == clist_ctl->node_len){
+		clist_wseal(clist_ctl);	/* ノードが一杯になった */
+	}
+}
+
+/*
+	循環リストにデータをコピーする関数
+	@src コピーするデータ
+	@len コピーするオブジェクトの個数
+	@clist_ctl 管理構造体のアドレス
+
+	データ長の検査はこの関数内では行っていない
+*/
+static void clist_wmemcpy(const void *src, int n, struct clist_controller *clist_ctl)
+{
+	clist_copy(clist_at(clist_ctl, clist_wnode(clist_ctl)->curr_ptr), src, n, clist_ctl);
+
+	clist_wadvance(n, clist_ctl);
+}
+
+/*
+	ノード単位でまとめて循環リストにデータをコピーする関数
+	@src コピーするデータ
+	@nr_nodes コピーするノードの個数
+	@clist_ctl 管理構造体のアドレス
+
+	w_currは書き込み前（curr_ptr == data）であること
+	メモリ上で隣接しているノードは1回のmemcpyでまとめて書き込む
+*/
+static void clist_wmemcpy_burst(const void *src, int nr_nodes, struct clist_controller *clist_ctl)
+{
+	int i, run;
+
+	while(nr_nodes > 0){
+		run = clist_adjacent_nodes(clist_wnode(clist_ctl), nr_nodes, clist_ctl);
+
+		if(clist_use_stream((size_t)run * clist_ctl->node_len, clist_ctl)){
+			clist_stream_copy(clist_at(clist_ctl, clist_wnode(clist_ctl)->data), src, (size_t)run * clist_ctl->node_len);
+		}
+		else{
+			memcpy(clist_at(clist_ctl, clist_wnode(clist_ctl)->data), src, run * clist_ctl->node_len);
+		}
+
+		for(i = 0; i < run; i++){
+			clist_wnode(clist_ctl)->fill = clist_ctl->node_len;
+			clist_lat_stamp(clist_wnode(clist_ctl), clist_ctl);
+			clist_ctl->w_curr = clist_wnode(clist_ctl)->next_node;
+		}
+		clist_wnode(clist_ctl)->curr_ptr = clist_wnode(clist_ctl)->data;
+
+		clist_store_release(&clist_ctl->w_seq, clist_ctl->w_seq + run);	/* runノード分をまとめて消費者に公開する */
+		clist_notify_pull(clist_ctl);
+
+		clist_wstat_add(&clist_ctl->wstats.objects, run * clist_ctl->nr_composed, clist_ctl);
+		clist_wstat_add(&clist_ctl->wstats.bytes, run * clist_ctl->node_len, clist_ctl);
+
+		src += run * clist_ctl->node_len;
+		nr_nodes -= run;
+	}
+
+	if(clist_ctl->shrink_period){
+		clist_shrink(clist_ctl);
+	}
+}
+
+/*
+	w_currに書き込まれている分だけで封をする関数
+	@expired flush_nsの期限で封をするなら1
+	@clist_ctl 管理構造体のアドレス
+	return 封をしたバイト数（w_currが空なら何もせずに0）
+
+	封をした後はw_currが次のノードに進むので、満杯になることがある（一杯になって封をした時と同じ）
+*/
+static int clist_wflush(int expired, struct clist_controller *clist_ctl)
+{
+	int len;
+
+	len = clist_wnode(clist_ctl)->curr_ptr - clist_wnode(clist_ctl)->data;
+
+	if(len == 0){
+		return 0;
+	}
+
+	clist_trace(CLIST_TRACE_FLUSH, clist_ctl, len, expired);
+	clist_wseal(clist_ctl);
+
+	return len;
+}
+
+/*
+	w_commitの値を作る関数
+	@seq w_currの通し番号（w_seq）
+	@len w_currに書き込み終わったバイト数
+*/
+static inline unsigned long long clist_commit_word(unsigned long long seq, int len)
+{
+	return ((unsigned long long)(unsigned int)seq << 32) | (unsigned int)len;
+}
+
+/*
+	消費者が期限切れで封をしたノードをw_seqで公開する関数（生産者と消費者のどちらが呼んでもよい）
+	@commit 封をした時のw_commit
+	@clist_ctl 管理構造体のアドレス
+
+	2人が同じノードに呼んでもw_seqはCASで1回しか進まない
+	fillとstampは封をした消費者が先に書く（読むのも消費者だけなので、生産者が先に公開しても構わない）
+*/
+static void clist_commit_seal(unsigned long long commit, struct clist_controller *clist_ctl)
+{
+	unsigned long long seq;
+
+	seq = clist_load_acquire(&clist_ctl->w_seq);
+
+	if((unsigned int)seq == (unsigned int)(commit >> 32) && clist_cmpxchg(&clist_ctl->w_seq, seq, seq + 1)){
+		clist_notify_pull(clist_ctl);
+	}
+}
+
+/*
+	消費者が期限切れで封をしたw_currを片付けて、次のノードに移る関数
+	@clist_ctl 管理構造体のアドレス
+
+	生産者がpushの最初に呼ぶ（clist_set_end()では止まった生産者の代わりに消費者が呼ぶ）
+	w_commitにCLIST_COMMIT_SEALEDが無ければ何もしない
+*/
+static void clist_wtakeover(struct clist_controller *clist_ctl)
+{
+	unsigned long long commit;
+
+	commit = clist_load_acquire(&clist_ctl->w_commit);
+
+	if(!(commit & CLIST_COMMIT_SEALED)){
+		return;
+	}
+
+	clist_commit_seal(commit, clist_ctl);	/* 消費者が封をした後で止まっていても、ここで公開する */
+
+	clist_store_relaxed(&clist_ctl->w_open, 0);
+	clist_ctl->w_curr = clist_wnode(clist_ctl)->next_node;
+	clist_wnode(clist_ctl)->curr_ptr = clist_wnode(clist_ctl)->data;
+	clist_store_release(&clist_ctl->w_commit, clist_commit_word(clist_ctl->w_seq, 0));	/* 空なので消費者は封をしない */
+}
+
+/*
+	flush_nsがある時に、SPSCモードとVARLENモードのpushの最初に呼ぶ関数
+	@clist_ctl 管理構造体のアドレス
+
+	w_commitにCLIST_COMMIT_BUSYを立てて、書き込んでいる間は消費者に封をさせない
+	必ず後でclist_wdeadline()を呼んでCLIST_COMMIT_BUSYを下ろすこと
+*/
+static inline void clist_wbegin(struct clist_controller *clist_ctl)
+{
+	unsigned long long commit;
+
+	if(clist_ctl->flush_ns == 0){
+		return;
+	}
+
+	do{
+		clist_wtakeover(clist_ctl);
+		commit = clist_load_relaxed(&clist_ctl->w_commit);
+	}while((commit & CLIST_COMMIT_SEALED) || !clist_cmpxchg(&clist_ctl->w_commit, commit, commit | CLIST_COMMIT_BUSY));
+}
+
+/*
+	w_currを開いてからflush_ns以上経っていたら封をする関数
+	@clist_ctl 管理構造体のアドレス
+
+	SPSCモードとVARLENモードのpushの最後に呼ぶ 時刻を読むのはflush_nsがある時だけ
+	最後にw_currの状態をw_commitに書いてCLIST_COMMIT_BUSYを下ろすので、pushが止まっても
+	期限が来れば消費者がclist_rseal()で封をする
+*/
+static inline void clist_wdeadline(struct clist_controller *clist_ctl)
+{
+	long long now;
+	int len;
+
+	if(clist_ctl->flush_ns == 0){
+		return;
+	}
+
+	len = clist_wnode(clist_ctl)->curr_ptr - clist_wnode(clist_ctl)->data;
+
+	if(len != 0){
+		now = clist_now_ns();
+
+		if(clist_ctl->w_open == 0){
+			clist_store_relaxed(&clist_ctl->w_open, now);	/* このpushでw_currを開いた */
+			clist_fence();
+
+			if(clist_load_relaxed(&clist_ctl->r_waiters)){
+				clist_futex_wake(&clist_ctl->r_futex, clist_ctl);	/* clist_pull_wait()に期限を知らせる */
+			}
+		}
+		else if(now - clist_ctl->w_open >= clist_ctl->flush_ns){
+			len -= clist_wflush(1, clist_ctl);
+		}
+	}
+
+	clist_store_release(&clist_ctl->w_commit, clist_commit_word(clist_ctl->w_seq, len));
+}
+
+/*
+	r_currの中で次に読み出すアドレスを返す関数
+	@clist_ctl 管理構造体のアドレス
+*/
+static inline void *clist_rhead(const struct clist_controller *clist_ctl)
+{
+	return clist_at(clist_ctl, clist_rnode(clist_ctl)->data + clist_ctl->r_pos);
+}
+
+/*
+	読み切ったr_currを生産者に返し、次のノードに進む関数
+	@clist_ctl 管理構造体のアドレス
+
+	r_currは消費者だけが触るので、r_seqをreleaseで公開すればロックは要らない
+	OVERWRITEモードでは生産者が一番古いノードを取り返すことがあるので、r_seqをCASで進める
+	（先に取り返されていたら、生産者が失ったオブジェクトに数えた分を戻す 中身は読み終わっている）
+*/
+static void clist_rnext(struct clist_controller *clist_ctl)
+{
+	int reclaimed = 0;
+	long long stamp = 0;
+	unsigned long long seq;
+
+	if(clist_ctl->mode & CLIST_MODE_LATENCY){
+		stamp = clist_load_relaxed(&clist_rnode(clist_ctl)->stamp);
+	}
+
+	if(clist_rnode(clist_ctl)->fill != clist_ctl->node_len){
+		clist_ctl->r_partial++;	/* 生産者のw_partialに対応する */
+	}
+
+	clist_ctl->r_pos = 0;
+	clist_rnode(clist_ctl)->committed = 0;
+	clist_store_relaxed(&clist_rnode(clist_ctl)->sealed, 0);	/* 古いw_seqを読んだMPSCの生産者が並行に覗くことがある */
+	clist_ctl->r_curr = clist_rnode(clist_ctl)->next_node;		/* w_currにノード1つ分だけ近づける */
+
+	seq = clist_ctl->r_cseq++;
+
+	if(!(clist_ctl->mode & CLIST_MODE_OVERWRITE)){
+		clist_store_release(&clist_ctl->r_seq, seq + 1);	/* ノードが空いたことを生産者に公開する */
+	}
+	else if(!clist_cmpxchg(&clist_ctl->r_seq, seq, seq + 1)){
+		clist_add_return(&clist_ctl->lost, -clist_ctl->nr_composed);
+		reclaimed = 1;	/* stampも上書きされているかもしれないので数えない */
+	}
+
+	if((clist_ctl->mode & CLIST_MODE_LATENCY) && !reclaimed){
+		clist_lat_record(stamp, clist_ctl);
+	}
+
+	clist_notify_push(clist_ctl);
+}
+
+/*
+	flush_nsの期限を過ぎても封をされないw_currに、消費者が代わりに封をする関数
+	@clist_ctl 管理構造体のアドレス
+	return 封をしたら1
+
+	読めるノードが無い時に呼ぶ（r_currがw_currと同じノード） 生産者がpushの途中なら何もしない
+	w_commitのCASに勝った時だけ封をして、w_currの片付けは生産者が次のpushで行う（clist_wtakeover()）
+*/
+static int clist_rseal(struct clist_controller *clist_ctl)
+{
+	unsigned long long seq, commit;
+	long long open;
+	int len;
+
+	if(clist_ctl->flush_ns == 0 || CLIST_IS_END(clist_ctl)){
+		return 0;	/* ENDの後はclist_pull_end()でw_currを読む */
+	}
+
+	seq = clist_load_acquire(&clist_ctl->w_seq);
+	commit = clist_load_acquire(&clist_ctl->w_commit);
+	open = clist_load_relaxed(&clist_ctl->w_open);	/* w_commitの後に読むので、w_commitを書いた時と同じかそれより新しい */
+	len = (int)(commit & CLIST_COMMIT_LEN);
+
+	if(seq != clist_ctl->r_seq || (unsigned int)(commit >> 32) != (unsigned int)seq
+		|| (commit & (CLIST_COMMIT_BUSY | CLIST_COMMIT_SEALED)) || len == 0){
+		return 0;
+	}
+
+	if(open == 0 || clist_now_ns() - open < clist_ctl->flush_ns){
+		return 0;
+	}
+
+	if(!clist_cmpxchg(&clist_ctl->w_commit, commit, commit | CLIST_COMMIT_SEALED)){
+		return 0;	/* 生産者がpushを始めた */
+	}
+
+	clist_rnode(clist_ctl)->fill = len;
+	clist_lat_stamp(clist_rnode(clist_ctl), clist_ctl);
+	clist_ctl->r_sealed++;
+
+	clist_trace(CLIST_TRACE_FLUSH, clist_ctl, len, 2);
+	clist_commit_seal(commit, clist_ctl);
+
+	return 1;
+}
+
+/*
+	r_currの読み出し位置をオブジェクトn個分だけ進める関数
+	@n 進めるオブジェクトの個数
+	@clist_ctl 管理構造体のアドレス
+*/
+static void clist_radvance(int n, struct clist_controller *clist_ctl)
+{
+	clist_ctl->r_pos += objs_to_byte(clist_ctl, n);
+
+	clist_rstat_add(&clist_ctl->rstats.objects, n);
+	clist_rstat_add(&clist_ctl->rstats.bytes, objs_to_byte(clist_ctl, n));
+
+	if(clist_ctl->r_pos == clist_rnode(clist_ctl)->fill){
+		clist_rnext(clist_ctl);	/* ノードを読み切った */
+	}
+}
+
+/*
+	循環リストからデータをコピーする関数
+	@dest コピー先のアドレス
+	@len コピーするデータの長さ（バイト）
+	@clist_ctl 管理構造体のアドレス
+
+	データ長の検査はこの関数内では行っていない
+*/
+static void clist_rmemcpy(void *dest, int n, struct clist_controller *clist_ctl)
+{
+	clist_copy(dest, clist_rhead(clist_ctl), n, clist_ctl);
+
+	clist_radvance(n, clist_ctl);
+}
+
+/*
+	ノード単位でまとめて循環リストからデータをコピーする関数
+	@dest コピー先のアドレス
+	@nr_nodes コピーするノードの個数
+	@clist_ctl 管理構造体のアドレス
+
+	r_currは読み込み前（r_pos == 0）であること OVERWRITEモードでは使わない
+	メモリ上で隣接しているノードは1回のmemcpyでまとめて読み込む
+*/
+static void clist_rmemcpy_burst(void *dest, int nr_nodes, struct clist_controller *clist_ctl)
+{
+	int i, run;
+
+	while(nr_nodes > 0){
+		run = clist_adjacent_nodes(clist_rnode(clist_ctl), nr_nodes, clist_ctl);
+
+		memcpy(dest, clist_at(clist_ctl, clist_rnode(clist_ctl)->data), run * clist_ctl->node_len);
+
+		for(i = 0; i < run; i++){
+			if(clist_ctl->mode & CLIST_MODE_LATENCY){
+				clist_lat_record(clist_load_relaxed(&clist_rnode(clist_ctl)->stamp), clist_ctl);
+			}
+
+			clist_rnode(clist_ctl)->committed = 0;
+			clist_store_relaxed(&clist_rnode(clist_ctl)->sealed, 0);
+			clist_ctl->r_curr = clist_rnode(clist_ctl)->next_node;
+		}
+
+		clist_ctl->r_cseq += run;
+		clist_store_release(&clist_ctl->r_seq, clist_ctl->r_cseq);	/* runノード分をまとめて生産者に返す */
+		clist_notify_push(clist_ctl);
+
+		clist_rstat_add(&clist_ctl->rstats.objects, run * clist_ctl->nr_composed);
+		clist_rstat_add(&clist_ctl->rstats.bytes, run * clist_ctl->node_len);
+
+		dest += run * clist_ctl->node_len;
+		nr_nodes -= run;
+	}
+}
+
+/*
+	MPSCモードで、claimの位置からwrite可能なオブジェクトの個数を返す関数
+	@claim 書き込みを始める位置（w_claim）
+	@clist_ctl 管理構造体のアドレス
+*/
+static int clist_mpsc_free_objects(unsigned long long claim, const struct clist_controller *clist_ctl)
+{
+	unsigned long long limit;
+
+	/* r_seqのノードからnr_node個先のノードの手前までが書ける（他の生産者の確保がはみ出していれば0） */
+	limit = (clist_load_acquire(&clist_ctl->r_seq) + clist_ctl->nr_node) * clist_ctl->nr_composed;
+
+	return (claim < limit) ? (int)(limit - claim) : 0;
+}
+
+/*
+	MPSCモードで、書き込みが終わったノードを先頭から順にw_seqで消費者に公開する関数
+	@clist_ctl 管理構造体のアドレス
+
+	ノードは確保された順ではなく書き込みが終わった順に揃うので、w_seqの次のノードがsealedである限り進める
+	前のノードがまだ書き込み中なら、それを完成させた生産者が続きを公開する
+	（sealedの書き込みと読み込みをseq_cstにして、2つの生産者が互いに相手の完成を見逃すことがないようにする）
+*/
+static void clist_mpsc_publish(struct clist_controller *clist_ctl)
+{
+	int published = 0;
+	unsigned long long seq;
+	struct clist_node *node;
+
+	seq = clist_load_mb(&clist_ctl->w_seq);
+
+	while(seq - clist_load_acquire(&clist_ctl->r_seq) < (unsigned long long)clist_ctl->nr_node){
+		node = &clist_nodes(clist_ctl)[seq % clist_ctl->nr_node];
+
+		if(!clist_load_mb(&node->sealed)){
+			break;
+		}
+
+		if(clist_try_cmpxchg(&clist_ctl->w_seq, &seq, seq + 1)){
+			seq++;
+			published = 1;
+		}
+	}
+
+	if(published){
+		clist_notify_pull(clist_ctl);
+	}
+}
+
+/*
+	MPSCモードで循環リストにデータを追加する関数
+	@data データが入っているアドレス
+	@n オブジェクトの個数
+	@clist_ctl 管理構造体のアドレス
+	return 成功：追加したオブジェクトの個数　失敗：マイナスのエラーコード
+
+	w_claimをfetch-addで進めて書き込む範囲を確保し、ノードごとのcommittedを加算する
+	CASのやり直しが無いので、競合しても生産者同士がw_claimのキャッシュラインを取り合い続けない
+	ロックを取らないので、別々のコアの生産者は書き込み中に互いを待たない
+
+	空きは確保の前に目安で確かめるだけなので、他の生産者と同時に確保すると空きをはみ出すことがある
+	後ろに誰も確保していなければはみ出した分をw_claimに返し、返せなければ消費者が空けるのを待って書く
+*/
+static int clist_mpsc_push(const void *data, int n, struct clist_controller *clist_ctl)
+{
+	unsigned long long claim;
+	int write_scope, take, fit, done, offset, piece;
+	struct clist_node *node;
+
+	write_scope = clist_mpsc_free_objects(clist_load_relaxed(&clist_ctl->w_claim), clist_ctl);
+
+	if(!clist_push_permitted(clist_ctl, write_scope)){
+		return -EAGAIN;	/* push禁止だったらエラー */
+	}
+
+	if(write_scope == 0){
+		clist_set_cold(clist_ctl);	/* push禁止に設定する */
+		return 0;
+	}
+
+	take = (n < write_scope) ? n : write_scope;
+
+	/* 書き込む範囲を確保する */
+	claim = clist_add_return(&clist_ctl->w_claim, take) - take;
+
+	fit = clist_mpsc_free_objects(claim, clist_ctl);
+
+	if(fit < take && clist_cmpxchg(&clist_ctl->w_claim, claim + take, claim + fit)){
+		take = fit;	/* はみ出した分を返せた */
+
+		if(take == 0){
+			clist_set_cold(clist_ctl);	/* push禁止に設定する */
+			return 0;
+		}
+	}
+
+	/* 確保した範囲をノードごとに書き込む */
+	for(done = 0; done < take; done += piece){
+		/* はみ出して確保したノードは消費者が読み終わるまで待つ（手前は書き終えているので消費者は進める） */
+		while(claim / clist_ctl->nr_composed - clist_load_acquire(&clist_ctl->r_seq) >= (unsigned long long)clist_ctl->nr_node){
+			clist_cpu_relax();
+		}
+
+		node = &clist_nodes(clist_ctl)[(claim / clist_ctl->nr_composed) % clist_ctl->nr_node];
+		offset = claim % clist_ctl->nr_composed;
+
+		piece = clist_ctl->nr_composed - offset;
+		if(piece > take - done){
+			piece = take - done;
+		}
+
+		memcpy(clist_at(clist_ctl, node->data + objs_to_byte(clist_ctl, offset)), data + objs_to_byte(clist_ctl, done), objs_to_byte(clist_ctl, piece));
+
+		if(clist_add_return(&node->committed, piece) == clist_ctl->nr_composed){
+			/* このノードの最後の書き込みだったので封をして公開する */
+			clist_lat_stamp(node, clist_ctl);
+			clist_store_mb(&node->sealed, 1);
+			clist_mpsc_publish(clist_ctl);
+		}
+
+		claim += piece;
+	}
+
+	clist_wstat_add(&clist_ctl->wstats.objects, take, clist_ctl);
+	clist_wstat_add(&clist_ctl->wstats.bytes, objs_to_byte(clist_ctl, take), clist_ctl);
+
+	return take;
+}
+
+/*
+	OVERWRITEモードで、一番古い完成済みのノードを生産者が取り返す関数
+	@clist_ctl 管理構造体のアドレス
+
+	循環リストが満杯の時に生産者側から呼び出す r_seqをCASで1つ進め、そのノードのオブジェクトを失ったものとして数える
+	消費者が先に読み終わっていればCASが失敗するので、数えた分を戻す
+	（消費者が取り返されたことに気づく前に数え終わるように、CASより先に加算する）
+*/
+static void clist_ow_reclaim(struct clist_controller *clist_ctl)
+{
+	unsigned long long seq;
+
+	seq = clist_ctl->w_seq - clist_ctl->nr_node;	/* w_currと同じノード */
+
+	clist_add_return(&clist_ctl->lost, clist_ctl->nr_composed);
+
+	if(!clist_cmpxchg(&clist_ctl->r_seq, seq, seq + 1)){
+		clist_add_return(&clist_ctl->lost, -clist_ctl->nr_composed);
+	}
+}
+
+/*
+	OVERWRITEモードで循環リストにデータを追加する関数
+	@data データが入っているアドレス
+	@n オブジェクトの個数
+	@clist_ctl 管理構造体のアドレス
+	return 追加したオブジェクトの個数（常にn）
+
+	満杯なら一番古いノードを取り返して書き込むので、消費者を待つことも失敗することもない
+*/
+static int clist_ow_push(const void *data, int n, struct clist_controller *clist_ctl)
+{
+	int ret = 0, n_first, take;
+
+	while(ret < n){
+		if(clist_filled_nodes(clist_ctl) == clist_ctl->nr_node){
+			clist_ow_reclaim(clist_ctl);
+		}
+
+		clist_pushable_objects(clist_ctl, &n_first, NULL);
+
+		take = (n - ret < n_first) ? n - ret : n_first;
+
+		clist_wmemcpy(data + objs_to_byte(clist_ctl, ret), take, clist_ctl);
+		ret += take;
+	}
+
+	return ret;
+}
+
+/*
+	OVERWRITEモードで、読んでいたノードが生産者に取り返されていたらr_currを残っている一番古いノードに合わせる関数
+	@clist_ctl 管理構造体のアドレス
+	return 取り返されていた:1 取り返されていない:0
+
+	取り返されたノードのうち既に読んでいた分は、生産者が失ったオブジェクトに数えた分から戻す
+*/
+static int clist_ow_resync(struct clist_controller *clist_ctl)
+{
+	unsigned long long seq;
+
+	seq = clist_load_acquire(&clist_ctl->r_seq);
+
+	if(seq == clist_ctl->r_cseq){
+		return 0;
+	}
+
+	clist_add_return(&clist_ctl->lost, -byte_to_objs(clist_ctl, clist_ctl->r_pos));
+
+	clist_ctl->r_cseq = seq;
+	clist_ctl->r_curr = clist_off(clist_ctl, &clist_nodes(clist_ctl)[seq % clist_ctl->nr_node]);
+	clist_ctl->r_pos = 0;
+
+	return 1;
+}
+
+/*
+	OVERWRITEモードで循環リストからデータを読む関数
+	@data データを格納するアドレス
+	@n 読み込む最大オブジェクト数
+	@clist_ctl 管理構造体のアドレス
+	return dataに格納したオブジェクトの個数
+
+	ノードごとにコピーしてからr_seqを読み直し、コピー中に生産者に取り返されていたらそのコピーを捨てる（seqlockと同じ考え方）
+	生産者はr_seqを進めてから書き込むので、r_seqが変わっていなければコピーした中身は上書きされていない
+*/
+static int clist_ow_pull(void *data, int n, struct clist_controller *clist_ctl)
+{
+	int ret = 0, take;
+	unsigned long long seq;
+
+	while(ret < n){
+		clist_ow_resync(clist_ctl);
+
+		seq = clist_ctl->r_cseq;
+
+		if(clist_load_acquire(&clist_ctl->w_seq) == seq){
+			break;	/* 完成したノードが無い */
+		}
+
+		take = byte_to_objs(clist_ctl, (clist_ctl->node_len - clist_ctl->r_pos));
+		if(take > n - ret){
+			take = n - ret;
+		}
+
+		memcpy(data + objs_to_byte(clist_ctl, ret), clist_rhead(clist_ctl), objs_to_byte(clist_ctl, take));
+
+		clist_fence_acquire();
+
+		if(clist_load_relaxed(&clist_ctl->r_seq) != seq){
+			continue;	/* 上書きされたかもしれないので捨てて読み直す */
+		}
+
+		clist_radvance(take, clist_ctl);
+		ret += take;
+	}
+
+	return ret;
+}
+
+/*
+	INDEXモードでオブジェクトの通し番号からデータのアドレスを求める関数
+	@obj オブジェクトの通し番号
+	@clist_ctl 管理構造体のアドレス
+
+	INDEXモードではノードを足さないので、全ノードのデータ領域はnodes[0]から隙間なく並んでいる
+*/
+static inline void *clist_index_at(const struct clist_controller *clist_ctl, unsigned long long obj)
+{
+	return clist_at(clist_ctl, clist_nodes(clist_ctl)[0].data + objs_to_byte(clist_ctl, (long)(obj & clist_ctl->index_mask)));
+}
+
+/*
+	INDEXモードで通し番号startからtotal個を、ノードの残りとノード丸ごとの数に分ける関数
+	@total 読み書きできるオブジェクトの個数
+	@start 次に読み書きするオブジェクトの通し番号
+	@n_first startのノードの残りの個数を格納するアドレス（任意）
+	@n_burst ノード丸ごとの数を格納するアドレス（任意）
+	return total
+*/
+static int clist_index_split(int total, unsigned long long start, const struct clist_controller *clist_ctl, int *n_first, int *n_burst)
+{
+	int first = 0;
+
+	if(total > 0){
+		first = clist_ctl->nr_composed - (int)(start & (clist_ctl->nr_composed - 1));
+	}
+
+	if(n_first){
+		*n_first = first;
+	}
+	if(n_burst){
+		*n_burst = (total - first) >> clist_ctl->index_shift;
+	}
+
+	return total;
+}
+
+/*
+	INDEXモードで循環リストの終わりをまたぐ時は2回に分けてコピーする関数
+	@node_side ノード側の先頭のオブジェクトの通し番号
+	@buf ユーザ側のバッファ
+	@n オブジェクトの個数
+	@to_node 1ならbufからノードへ、0ならノードからbufへコピーする
+	@clist_ctl 管理構造体のアドレス
+*/
+static void clist_index_copy(unsigned long long node_side, void *buf, int n, int to_node, const struct clist_controller *clist_ctl)
+{
+	int piece;
+
+	piece = (int)(clist_ctl->index_mask + 1 - (node_side & clist_ctl->index_mask));
+
+	if(piece > n){
+		piece = n;
+	}
+
+	if(to_node){
+		clist_copy(clist_index_at(clist_ctl, node_side), buf, piece, clist_ctl);
+		clist_copy(clist_index_at(clist_ctl, node_side + piece), buf + objs_to_byte(clist_ctl, piece), n - piece, clist_ctl);
+	}
+	else{
+		clist_copy(buf, clist_index_at(clist_ctl, node_side), piece, clist_ctl);
+		clist_copy(buf + objs_to_byte(clist_ctl, piece), clist_index_at(clist_ctl, node_side + piece), n - piece, clist_ctl);
+	}
+}
+
+/*
+	INDEXモードのpush
+	@data データが入っているアドレス
+	@n オブジェクトの個数
+	@clist_ctl 管理構造体のアドレス
+	return 成功：追加したオブジェクトの個数　失敗：マイナスのエラーコード
+
+	空きは「全体の個数 - (w_obj - 読み切られたノードの先頭)」の引き算1回で求める（読み込み中のノードには書かない）
+	キャッシュしたr_seqで足りない時だけr_seqを読み直す ノードが完成したらw_seqをまとめて進めて消費者に公開する
+*/
+static int clist_index_push(const void *data, int n, struct clist_controller *clist_ctl)
+{
+	int write_scope;
+	unsigned long long w_obj, seq;
+
+	w_obj = clist_ctl->w_obj;
+	write_scope = (int)(clist_ctl->index_mask + 1 - (w_obj - (clist_ctl->r_seq_cache << clist_ctl->index_shift)));
+
+	if(write_scope < n){
+		clist_ctl->r_seq_cache = clist_load_acquire(&clist_ctl->r_seq);
+		write_scope = (int)(clist_ctl->index_mask + 1 - (w_obj - (clist_ctl->r_seq_cache << clist_ctl->index_shift)));
+	}
+
+	if(!clist_push_permitted(clist_ctl, write_scope)){
+		return -EAGAIN;	/* push禁止だったらエラー */
+	}
+
+	if(write_scope == 0){
+		clist_set_cold(clist_ctl);	/* push禁止に設定する */
+		return 0;
+	}
+
+	if(n > write_scope){
+		n = write_scope;
+	}
+
+	clist_index_copy(w_obj, (void *)data, n, 1, clist_ctl);
+	clist_ctl->w_obj = w_obj + n;
+
+	clist_wstat_add(&clist_ctl->wstats.objects, n, clist_ctl);
+	clist_wstat_add(&clist_ctl->wstats.bytes, objs_to_byte(clist_ctl, n), clist_ctl);
+
+	seq = clist_ctl->w_obj >> clist_ctl->index_shift;
+
+	if(seq != clist_ctl->w_seq){	/* ノードが完成した */
+		for(w_obj = clist_ctl->w_seq; w_obj < seq; w_obj++){
+			clist_lat_stamp(&clist_nodes(clist_ctl)[w_obj & (clist_ctl->nr_node - 1)], clist_ctl);
+		}
+
+		clist_store_release(&clist_ctl->w_seq, seq);	/* 完成したノードをまとめて消費者に公開する */
+		clist_notify_pull(clist_ctl);
+	}
+
+	return n;
+}
+
+/*
+	INDEXモードのpull
+	@data データを格納するアドレス
+	@n 読み込む最大オブジェクト数
+	@clist_ctl 管理構造体のアドレス
+	return dataに格納したオブジェクトの個数
+
+	読めるのは「完成したノードの終わり - r_obj」の引き算1回で求める（書き込み中のノードは読まない）
+	キャッシュしたw_seqで足りない時だけw_seqを読み直す ノードを読み切ったらr_seqを進めて生産者に返す
+*/
+static int clist_index_pull(void *data, int n, struct clist_controller *clist_ctl)
+{
+	int read_scope;
+	unsigned long long r_obj, seq;
+
+	r_obj = clist_ctl->r_obj;
+	read_scope = (int)((clist_ctl->w_seq_cache << clist_ctl->index_shift) - r_obj);
+
+	if(read_scope < n){
+		clist_ctl->w_seq_cache = clist_load_acquire(&clist_ctl->w_seq);
+		read_scope = (int)((clist_ctl->w_seq_cache << clist_ctl->index_shift) - r_obj);
+	}
+
+	if(n > read_scope){
+		n = read_scope;
+	}
+
+	if(n == 0){
+		return 0;
+	}
+
+	clist_index_copy(r_obj, data, n, 0, clist_ctl);
+	clist_ctl->r_obj = r_obj + n;
+
+	clist_rstat_add(&clist_ctl->rstats.objects, n);
+	clist_rstat_add(&clist_ctl->rstats.bytes, objs_to_byte(clist_ctl, n));
+
+	seq = clist_ctl->r_obj >> clist_ctl->index_shift;
+
+	if(seq != clist_ctl->r_cseq){	/* ノードを読み切った */
+		if(clist_ctl->mode & CLIST_MODE_LATENCY){
+			for(r_obj = clist_ctl->r_cseq; r_obj < seq; r_obj++){
+				clist_lat_record(clist_load_relaxed(&clist_nodes(clist_ctl)[r_obj & (clist_ctl->nr_node - 1)].stamp), clist_ctl);
+			}
+		}
+
+		clist_ctl->r_cseq = seq;
+		clist_store_release(&clist_ctl->r_seq, seq);	/* 読み切ったノードをまとめて生産者に返す */
+		clist_notify_push(clist_ctl);
+	}
+
+	return n;
+}
+
+/*
+	INDEXモードで書き込み中のノードからデータを読む関数（clist_pull_end()から呼ぶ）
+	@data データを格納するアドレス
+	@clist_ctl 管理構造体のアドレス
+	return 成功：dataに格納したオブジェクトの個数 失敗：マイナスのエラーコード
+*/
+static int clist_index_pull_end(void *data, struct clist_controller *clist_ctl)
+{
+	int n;
+
+	if(!CLIST_IS_END(clist_ctl)){
+		return -ECANCELED;
+	}
+
+	n = (int)(clist_ctl->w_obj & (clist_ctl->nr_composed - 1));
+
+	memcpy(data, clist_index_at(clist_ctl, clist_ctl->w_obj - n), objs_to_byte(clist_ctl, n));
+	clist_ctl->w_obj -= n;
+
+	clist_rstat_add(&clist_ctl->rstats.objects, n);
+	clist_rstat_add(&clist_ctl->rstats.bytes, objs_to_byte(clist_ctl, n));
+	clist_rstat_add(&clist_ctl->rstats.pull_end, 1);
+
+	return n;
+}
+
+/***********************************
+*
+*		公開用関数
+*
+************************************/
+
+/*
+	read可能なオブジェクトの個数を求める関数
+	@clist_ctl 管理用構造体のアドレス
+	@w_seq 生産者の位置として読むアドレス（&clist_ctl->w_seqか、消費者がキャッシュした&clist_ctl->w_seq_cache）
+	@n_first/@n_burst clist_pullable_objects()と同じ（任意）
+*/
+static int clist_pull_scope(const struct clist_controller *clist_ctl, const unsigned long long *w_seq, int *n_first, int *n_burst)
+{
+	int first, burst, wait_length;
+
+	if(clist_ctl->mode & CLIST_MODE_INDEX){
+		return clist_index_split((int)((clist_load_acquire(w_seq) << clist_ctl->index_shift) - clist_ctl->r_obj), clist_ctl->r_obj, clist_ctl, n_first, n_burst);
+	}
+
+	/* r_seqは消費者だけが更新するのでrelaxedで読み、w_seqはacquireで読んでノードの中身を見えるようにする */
+	wait_length = (int)(clist_load_acquire(w_seq) - clist_load_relaxed(&clist_ctl->r_seq));
+
+	if(wait_length == 0){
+		first = 0;
+		burst = 0;
+	}
+	else{
+		/* r_currの読み残しのオブジェクト数を計算（clist_flush()で封をしたノードはfillまで） */
+		first = byte_to_objs(clist_ctl, (clist_rnode(clist_ctl)->fill - clist_ctl->r_pos));
+
+		/* 読み残しの分もwait_lengthに含まれているので1を引く */
+		burst = wait_length - 1;
+	}
+
+	/* NULLでなかったら引数のアドレスに代入 */
+	if(n_first){
+		*n_first = first;
+	}
+	if(n_burst){
+		*n_burst = burst;
+	}
+
+	return first + (burst * clist_ctl->nr_composed);
+}
+
+/*
+	read可能なデータのサイズを返す関数
+	@clist_ctl 管理用構造体のアドレス
+	@n_first ノードに残っているバイト数を格納する関数（任意）
+	@n_burst ノード丸ごと読む場合、いくつのノードか（任意）
+	return read可能なオブジェクトの個数
+
+	※現在書き込み中のノードはread対象にはならない 消費者側から呼び出すこと
+	  clist_flush()で封をしたノードがr_currより後にあっても一杯として数えるので、その時は上限になる
+*/
+int clist_pullable_objects(const struct clist_controller *clist_ctl, int *n_first, int *n_burst)
+{
+	return clist_pull_scope(clist_ctl, &clist_ctl->w_seq, n_first, n_burst);
+}
+EXPORT_SYMBOL(clist_pullable_objects);
+
+/*
+	消費者側から見たread可能なオブジェクトの個数を求める関数
+	@n 読みたいオブジェクトの個数
+	@clist_ctl 管理用構造体のアドレス
+	@n_first/@n_burst clist_pullable_objects()と同じ（任意）
+
+	キャッシュしたw_seqで足りなければ（空に見えたら）w_seqを読み直す
+	足りている間は生産者のキャッシュラインを読まない それでも空ならflush_nsの期限切れを確かめる
+*/
+static int clist_rscope(int n, struct clist_controller *clist_ctl, int *n_first, int *n_burst)
+{
+	int read_scope;
+
+	read_scope = clist_pull_scope(clist_ctl, &clist_ctl->w_seq_cache, n_first, n_burst);
+
+	if(read_scope < n){
+		clist_ctl->w_seq_cache = clist_load_acquire(&clist_ctl->w_seq);
+		clist_ctl->w_partial_cache = clist_load_relaxed(&clist_ctl->w_partial);	/* w_seqの後に読むので、w_seq_cacheまでの分は必ず数えられている */
+		read_scope = clist_pull_scope(clist_ctl, &clist_ctl->w_seq_cache, n_first, n_burst);
+
+		if(read_scope == 0 && clist_rseal(clist_ctl)){
+			clist_ctl->w_seq_cache = clist_load_acquire(&clist_ctl->w_seq);	/* 封をしたw_currを読む */
+			read_scope = clist_pull_scope(clist_ctl, &clist_ctl->w_seq_cache, n_first, n_burst);
+		}
+	}
+
+	return read_scope;
+}
+
+/*
+	write可能なオブジェクトの個数を求める関数
+	@clist_ctl 管理用構造体のアドレス
+	@r_seq 消費者の位置として読むアドレス（&clist_ctl->r_seqか、生産者がキャッシュした&clist_ctl->r_seq_cache）
+	@n_first/@n_burst clist_pushable_objects()と同じ（任意）
+*/
+static int clist_push_scope(const struct clist_controller *clist_ctl, const unsigned long long *r_seq, int *n_first, int *n_burst)
+{
+	int curr_len, flen = 0, burst, wait_length;
+	unsigned long long claim;
+
+	if(clist_ctl->mode & CLIST_MODE_INDEX){
+		return clist_index_split((int)(clist_ctl->index_mask + 1 - (clist_ctl->w_obj - (clist_load_acquire(r_seq) << clist_ctl->index_shift))),
+					clist_ctl->w_obj, clist_ctl, n_first, n_burst);
+	}
+
+	if(clist_ctl->mode & CLIST_MODE_MPSC){
+		/* MPSCモードではw_currを使わずにw_claimから求める */
+		claim = clist_load_relaxed(&clist_ctl->w_claim);
+		wait_length = (int)(claim / clist_ctl->nr_composed - clist_load_acquire(r_seq));
+		curr_len = objs_to_byte(clist_ctl, (int)(claim % clist_ctl->nr_composed));
+	}
+	else{
+		/* w_seqは生産者だけが更新するのでrelaxedで読み、r_seqはacquireで読んで消費者の読み込み完了を確認する */
+		wait_length = (int)(clist_load_relaxed(&clist_ctl->w_seq) - clist_load_acquire(r_seq));
+		curr_len = 0;
+	}
+
+	if(wait_length == clist_ctl->nr_node){
+		/* w_currがr_currに追いついているなら0 */
+		flen = 0;
+		burst = 0;
+	}
+	else{
+		if(!(clist_ctl->mode & CLIST_MODE_MPSC)){
+			/* w_currに何バイトまで書き込みされているか計算（満杯の時はr_currと同じノードなので読まない） */
+			curr_len = clist_wnode(clist_ctl)->curr_ptr - clist_wnode(clist_ctl)->data;
+		}
+
+		burst = clist_ctl->nr_node - wait_length;
+
+		/* w_currにあと何バイト書き込めるか計算 */
+		if(clist_ctl->node_len > curr_len){
+			flen = (clist_ctl->node_len - curr_len) / clist_ctl->object_size;
+			burst -= 1;	/* burstには書き込み中のノードも含んでいるため-1 */
+		}
+		else{	/* curr_ptr - dataは0未満にはならないのでここを通るということはcurr_ptr == data */
+			;
+		}
+	}
+
+	/* 引数のアドレスが有効なら代入する */
+	if(n_first){
+		*n_first = flen;
+	}
+
+	if(n_burst){
+		*n_burst = burst;
+	}
+
+	return flen + (burst * clist_ctl->nr_composed);
+}
+
+/*
+	write可能なデータのサイズを返す関数
+	@clist_ctl 管理用構造体のアドレス
+	@n_first ノードに残っているバイト数を格納する関数（任意）
+	@n_burst ノード丸ごと読む場合、いくつのノードか（任意）
+	return write可能なオブジェクトの個数
+
+	※現在読み込み中のノードはwrite対象にはならない 生産者側から呼び出すこと
+*/
+int clist_pushable_objects(const struct clist_controller *clist_ctl, int *n_first, int *n_burst)
+{
+	return clist_push_scope(clist_ctl, &clist_ctl->r_seq, n_first, n_burst);
+}
+EXPORT_SYMBOL(clist_pushable_objects);
+
+/*
+	生産者側から見たwrite可能なオブジェクトの個数を求める関数（SPSCモード用）
+	@n 書き込みたいオブジェクトの個数
+	@clist_ctl 管理用構造体のアドレス
+	@n_first/@n_burst clist_pushable_objects()と同じ（任意）
+
+	キャッシュしたr_seqで足りなければ（満杯に見えたら）r_seqを読み直す
+	足りている間は消費者のキャッシュラインを読まない
+*/
+static int clist_wscope(int n, struct clist_controller *clist_ctl, int *n_first, int *n_burst)
+{
+	int write_scope;
+
+	write_scope = clist_push_scope(clist_ctl, &clist_ctl->r_seq_cache, n_first, n_burst);
+
+	if(write_scope < n){
+		clist_ctl->r_seq_cache = clist_load_acquire(&clist_ctl->r_seq);
+		write_scope = clist_push_scope(clist_ctl, &clist_ctl->r_seq_cache, n_first, n_burst);
+	}
+
+	return write_scope;
+}
+
+/*
+	生産者側から見て循環リストが満杯かを返す関数（SPSCモード用）
+	キャッシュしたr_seqで満杯に見えた時だけr_seqを読み直して確かめる
+*/
+static int clist_wfull(struct clist_controller *clist_ctl)
+{
+	if((int)(clist_ctl->w_seq - clist_ctl->r_seq_cache) < clist_ctl->nr_node){
+		return 0;
+	}
+
+	clist_ctl->r_seq_cache = clist_load_acquire(&clist_ctl->r_seq);
+
+	return (int)(clist_ctl->w_seq - clist_ctl->r_seq_cache) == clist_ctl->nr_node;
+}
+
+/*
+	循環リスト内に存在するすべてのデータのサイズを返す関数
+	@clist_ctl 管理用構造体のアドレス
+	@n_first ノードに残っているバイト数を格納する関数（任意）
+	@n_burst ノード丸ごと読む場合、いくつのノードか（任意）
+	return w_currに存在しているオブジェクトの個数
+
+	※この関数を呼び出すとclistはENDモードに突入する clist_free()の直前に呼び出すこと
+	  w_currを読むので生産者が止まってから消費者側で呼び出すこと
+*/
+int clist_set_end(struct clist_controller *clist_ctl, int *n_first, int *n_burst)
+{
+	int first, burst, offset, ret;
+	unsigned long long claim;
+
+	clist_store_release(&clist_ctl->state, CLIST_STATE_END);	/* END状態に遷移させる */
+
+	/* 寝ているスレッドがいればENDになったことを知らせる */
+	clist_notify_pull(clist_ctl);
+	clist_notify_push(clist_ctl);
+
+	if(clist_ctl->rd_fd >= 0){	/* 書き込み中のノードを読ませるために必ず通知する */
+		clist_eventfd_signal(clist_ctl->rd_fd);
+	}
+
+	clist_wtakeover(clist_ctl);	/* 消費者が期限切れで封をしたw_currをclist_pull_end()で読み直さない */
+
+	if((clist_ctl->mode & CLIST_MODE_VARLEN) && clist_wnode(clist_ctl)->curr_ptr != clist_wnode(clist_ctl)->data){
+		clist_wseal(clist_ctl);	/* 書き込み中のレコードもclist_pull_record()で読めるように封をする */
+	}
+
+	if(clist_ctl->mode & CLIST_MODE_MPSC){
+		/* MPSCモードではw_currを使っていないので、書き込み中のノードをw_claimから求める */
+		claim = clist_load_acquire(&clist_ctl->w_claim);
+		offset = claim % clist_ctl->nr_composed;
+
+		clist_ctl->w_curr = clist_off(clist_ctl, &clist_nodes(clist_ctl)[(claim / clist_ctl->nr_composed) % clist_ctl->nr_node]);
+		clist_wnode(clist_ctl)->curr_ptr = clist_wnode(clist_ctl)->data + objs_to_byte(clist_ctl, offset);
+	}
+
+	clist_pullable_objects(clist_ctl, &first, &burst);
+
+	/* NULLでなかったら引数のアドレスに代入 */
+	if(n_first){
+		*n_first = first;
+	}
+	if(n_burst){
+		*n_burst = burst;
+	}
+
+	if(clist_ctl->mode & CLIST_MODE_INDEX){
+		ret = (int)(clist_ctl->w_obj & (clist_ctl->nr_composed - 1));	/* 完成していないノードの分 */
+	}
+	else{
+		ret = (int)(clist_wnode(clist_ctl)->curr_ptr - clist_wnode(clist_ctl)->data) / clist_ctl->object_size;
+	}
+
+	clist_trace(CLIST_TRACE_END, clist_ctl, ret, 0);
+
+	return ret;
+}
+EXPORT_SYMBOL(clist_set_end);
+
+
+/*
+	clist_controllerとノードを初期化する関数
+	@clist_ctl 管理用構造体のアドレス（nodes、slabは呼び出し元で用意しておく）
+	@slab 全ノードのデータ領域
+	@nr_node 循環リストの段数
+	@nr_composed 循環リスト１段に含まれるオブジェクトの数
+*/
+static void clist_init(struct clist_controller *clist_ctl, char *slab, int nr_node, int nr_composed, int object_size)
+{
+	int i;
+	struct clist_node *nodes;
+
+	clist_ctl->mode = CLIST_MODE_SPSC;
+
+	clist_ctl->w_seq = 0;
+	clist_ctl->r_seq = 0;
+	clist_ctl->r_cseq = 0;
+	clist_ctl->r_pos = 0;
+	clist_ctl->w_claim = 0;
+	clist_ctl->r_seq_cache = 0;
+	clist_ctl->w_seq_cache = 0;
+	clist_ctl->w_obj = 0;
+	clist_ctl->r_obj = 0;
+	clist_ctl->w_partial = 0;
+	clist_ctl->w_open = 0;
+	clist_ctl->w_commit = 0;
+	clist_ctl->r_partial = 0;
+	clist_ctl->w_partial_cache = 0;
+	clist_ctl->r_sealed = 0;
+	clist_ctl->r_open = 0;
+	clist_ctl->r_fd_pos = 0;
+	clist_ctl->flush_ns = 0;
+	clist_ctl->index_shift = 0;
+	clist_ctl->index_mask = 0;
+	clist_ctl->lost = 0;
+
+	clist_ctl->r_futex = 0;
+	clist_ctl->w_futex = 0;
+	clist_ctl->r_waiters = 0;
+	clist_ctl->w_waiters = 0;
+
+	clist_ctl->rd_fd = -1;
+	clist_ctl->wr_fd = -1;
+	clist_ctl->rd_mark = 1;
+	clist_ctl->wr_mark = nr_node - 1;
+	clist_ctl->rd_armed = 0;
+	clist_ctl->wr_armed = 0;
+
+	clist_ctl->nr_node = nr_node;
+	clist_ctl->max_node = nr_node;
+	clist_ctl->node_len = object_size * nr_composed;
+	clist_ctl->chunks = NULL;
+
+	clist_ctl->min_node = nr_node;
+	clist_ctl->shrink_period = 0;
+	clist_ctl->shrink_count = 0;
+	clist_ctl->shrink_peak = 0;
+	clist_ctl->spare = 0;
+	clist_ctl->nr_spare = 0;
+
+	clist_ctl->nr_composed = nr_composed;
+	clist_ctl->object_size = object_size;
+
+	clist_ctl->copy_policy = CLIST_COPY_AUTO;
+	clist_copy_setup(clist_ctl);
+
+	nodes = clist_nodes(clist_ctl);
+
+	for(i = 0; i < clist_ctl->nr_node; i++){
+		nodes[i].data = clist_off(clist_ctl, slab + (size_t)i * clist_ctl->node_len);
+	}
+
+	/* アドレスをつなぐ */
+	for(i = 0; i < clist_ctl->nr_node; i++){
+		if(i < clist_ctl->nr_node - 1){
+			nodes[i].next_node = clist_off(clist_ctl, &nodes[i + 1]);
+		}
+		else{	/* 最後のcellは最初のcellにつなぐ */
+			nodes[i].next_node = clist_off(clist_ctl, &nodes[0]);
+		}
+
+		nodes[i].curr_ptr = nodes[i].data;
+		nodes[i].fill = clist_ctl->node_len;
+		nodes[i].committed = 0;
+		nodes[i].sealed = 0;
+		nodes[i].stamp = 0;
+	}
+
+	memset(clist_ctl->lat_hist, 0, sizeof(clist_ctl->lat_hist));
+	memset(&clist_ctl->wstats, 0, sizeof(clist_ctl->wstats));
+	memset(&clist_ctl->rstats, 0, sizeof(clist_ctl->rstats));
+
+	/* 初期値を代入 */
+	clist_ctl->w_curr = clist_ctl->nodes;
+	clist_ctl->r_curr = clist_ctl->nodes;
+
+	/* 入出力可能フラグ */
+	clist_ctl->state = CLIST_STATE_HOT;
+}
+
+/*
+	メモリをallocして循環リストを構築する関数
+	@nr_node 循環リストの段数
+	@nr_composed 循環リスト１段に含まれるオブジェクトの数
+
+	return 成功:clist_controllerのアドレス 失敗:NULL
+*/
+struct clist_controller *clist_alloc(int nr_node, int nr_composed, int object_size)
+{
+	struct clist_controller *clist_ctl;
+	struct clist_node *nodes;
+
+	/* 統計を生産者と消費者でキャッシュラインを分けて置くので、キャッシュラインの境界に揃える */
+	clist_ctl = (struct clist_controller *)clist_aligned_alloc(CLIST_CACHELINE_SIZE, sizeof(struct clist_controller));
+
+	if(clist_ctl == NULL){	/* エラー */
+		return NULL;
+	}
+
+	/* メモリを確保 */
+	nodes = (struct clist_node *)clist_zalloc((size_t)nr_node * sizeof(struct clist_node));
+
+	if(nodes == NULL){	/* エラー */
+		clist_aligned_free(clist_ctl);
+		return NULL;
+	}
+
+	/* 全ノードのデータ領域を1つの連続した領域から切り出す */
+	clist_ctl->slab = clist_slab_alloc((size_t)nr_node * object_size * nr_composed);
+
+	if(clist_ctl->slab == NULL){	/* エラー */
+		clist_mfree(nodes);
+		clist_aligned_free(clist_ctl);
+		return NULL;
+	}
+
+	clist_ctl->magic = 0;
+	clist_ctl->shared = 0;
+	clist_ctl->nodes = clist_off(clist_ctl, nodes);
+
+	clist_init(clist_ctl, clist_ctl->slab, nr_node, nr_composed, object_size);
+
+	return clist_ctl;
+}
+EXPORT_SYMBOL(clist_alloc);
+
+#ifndef CLIST_PORT_KERNEL
+/*
+	共有メモリ上の循環リストの大きさを求める関数
+	@nodes_off ノード配列のオフセットを返すアドレス
+	@slab_off データ領域のオフセットを返すアドレス（ページ境界に揃える）
+	return 共有メモリ全体の大きさ（バイト）
+*/
+static size_t clist_shared_layout(int nr_node, int nr_composed, int object_size, size_t *nodes_off, size_t *slab_off)
+{
+	size_t page;
+
+	page = clist_page_size();
+
+	*nodes_off = (sizeof(struct clist_controller) + CLIST_CACHELINE_SIZE - 1) & ~((size_t)CLIST_CACHELINE_SIZE - 1);
+	*slab_off = (*nodes_off + (size_t)nr_node * sizeof(struct clist_node) + page - 1) & ~(page - 1);
+
+	return *slab_off + (size_t)nr_node * object_size * nr_composed;
+}
+
+/*
+	POSIX共有メモリの上に循環リストを構築する関数
+	@name shm_open()に渡す名前（"/"で始める）
+	@nr_node 循環リストの段数
+	@nr_composed 循環リスト１段に含まれるオブジェクトの数
+	return 成功:clist_controllerのアドレス 失敗:NULL（errnoに理由が入る）
+
+	別のプロセスはclist_attach_shared()に同じ名前を渡して同じ循環リストを使う
+	clist_controller、ノード、データ領域が1つのマッピングに収まり、中ではオフセットで指し合うので、
+	プロセスごとにマップされるアドレスが違ってもよい
+	※名前は既に存在してはいけない 使い終わったらclist_free()の後でshm_unlink()すること
+	※ノードを足す・外すポリシーとeventfdは使えない（ブロッキングはプロセス間のfutexで動く）
+*/
+struct clist_controller *clist_alloc_shared(const char *name, int nr_node, int nr_composed, int object_size)
+{
+	int fd, err;
+	size_t len, nodes_off, slab_off;
+	struct clist_controller *clist_ctl;
+
+	if(nr_node < 2 || nr_composed < 1 || object_size < 1){
+		errno = EINVAL;
+		return NULL;
+	}
+
+	len = clist_shared_layout(nr_node, nr_composed, object_size, &nodes_off, &slab_off);
+
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+	if(fd < 0){	/* エラー */
+		return NULL;
+	}
+
+	if(ftruncate(fd, (off_t)len) < 0){	/* エラー */
+		err = errno;
+		close(fd);
+		shm_unlink(name);
+		errno = err;
+		return NULL;
+	}
+
+	clist_ctl = (struct clist_controller *)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	err = errno;
+	close(fd);	/* マッピングは閉じても残る */
+
+	if(clist_ctl == MAP_FAILED){	/* エラー */
+		shm_unlink(name);
+		errno = err;
+		return NULL;
+	}
+
+	clist_ctl->slab = NULL;	/* 共有メモリの一部なので個別には解放しない */
+	clist_ctl->shared = len;
+	clist_ctl->nodes = (long)nodes_off;
+
+	clist_init(clist_ctl, (char *)clist_at(clist_ctl, slab_off), nr_node, nr_composed, object_size);
+
+	/* 初期化が終わってからattachできるようにする */
+	clist_store_release(&clist_ctl->magic, CLIST_SHARED_MAGIC);
+
+	return clist_ctl;
+}
+
+/*
+	別のプロセスがclist_alloc_shared()で作った循環リストをマップする関数
+	@name clist_alloc_shared()に渡した名前
+	return 成功:clist_controllerのアドレス 失敗:NULL（errnoに理由が入る）
+
+	作った側の初期化が終わっていなければEAGAINで失敗する 使い終わったらclist_free()でunmapする
+*/
+struct clist_controller *clist_attach_shared(const char *name)
+{
+	int fd, err;
+	struct stat st;
+	size_t nodes_off, slab_off;
+	struct clist_controller *clist_ctl;
+
+	fd = shm_open(name, O_RDWR, 0);
+
+	if(fd < 0){	/* エラー */
+		return NULL;
+	}
+
+	if(fstat(fd, &st) < 0){	/* エラー */
+		err = errno;
+		close(fd);
+		errno = err;
+		return NULL;
+	}
+
+	if((size_t)st.st_size < sizeof(struct clist_controller)){
+		close(fd);
+		errno = EAGAIN;	/* まだftruncate()されていない */
+		return NULL;
+	}
+
+	clist_ctl = (struct clist_controller *)mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	err = errno;
+	close(fd);
+
+	if(clist_ctl == MAP_FAILED){	/* エラー */
+		errno = err;
+		return NULL;
+	}
+
+	if(clist_load_acquire(&clist_ctl->magic) != CLIST_SHARED_MAGIC){
+		munmap(clist_ctl, (size_t)st.st_size);
+		errno = EAGAIN;	/* まだ初期化中 */
+		return NULL;
+	}
+
+	/* ヘッダが共有メモリの大きさと食い違っていたら使わない */
+	if(clist_ctl->shared != (unsigned long)st.st_size
+		|| clist_shared_layout(clist_ctl->nr_node, clist_ctl->nr_composed, clist_ctl->object_size, &nodes_off, &slab_off) != (size_t)st.st_size){
+		munmap(clist_ctl, (size_t)st.st_size);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	clist_copy_setup(NULL);	/* このプロセスのCPUでAVXが使えるか調べる */
+
+	return clist_ctl;
+}
+#endif	/* CLIST_PORT_KERNEL */
+
+/*
+	メモリを解放する関数
+	@clist_ctl ユーザがallocしたclist_controller構造体のアドレス
+
+	共有メモリの循環リストはこのプロセスのマッピングを外すだけ（shm_unlink()は呼び出し元で行う）
+*/
+void clist_free(struct clist_controller *clist_ctl)
+{
+	struct clist_chunk *chunk;
+
+#ifndef CLIST_PORT_KERNEL
+	if(clist_ctl->shared){
+		munmap(clist_ctl, clist_ctl->shared);
+		return;
+	}
+
+	if(clist_ctl->rd_fd >= 0){
+		close(clist_ctl->rd_fd);
+	}
+	if(clist_ctl->wr_fd >= 0){
+		close(clist_ctl->wr_fd);
+	}
+#endif
+
+	/* 後から足したノードを解放 */
+	while(clist_ctl->chunks){
+		chunk = clist_ctl->chunks;
+		clist_ctl->chunks = chunk->next;
+
+		clist_aligned_free(chunk->slab);
+		clist_mfree(chunk);
+	}
+
+	/* データを解放（全ノードで1つの領域） */
+	clist_aligned_free(clist_ctl->slab);
+
+	/* ノードを解放 */
+	clist_mfree(clist_nodes(clist_ctl));
+	clist_aligned_free(clist_ctl);
+}
+EXPORT_SYMBOL(clist_free);
+
+/*
+	循環リストの動作モードを設定する関数
+	@clist_ctl 管理用構造体のアドレス
+	@mode CLIST_MODE_*の論理和
+	return 成功：0　失敗：マイナスのエラーコード
+
+	※最初のpushより前に呼び出すこと
+*/
+int clist_set_mode(struct clist_controller *clist_ctl, int mode)
+{
+	if(mode & ~CLIST_MODE_MASK){
+		return -EINVAL;
+	}
+
+	if((mode & CLIST_MODE_MPSC) && (mode & CLIST_MODE_OVERWRITE)){
+		return -EINVAL;	/* 取り返すノードを生産者同士で決められない */
+	}
+
+	if((mode & CLIST_MODE_VARLEN) && (mode & (CLIST_MODE_MPSC | CLIST_MODE_OVERWRITE))){
+		return -EINVAL;	/* レコードはSPSCでしか扱えない */
+	}
+
+	if((mode & CLIST_MODE_INDEX) && (mode & (CLIST_MODE_MPSC | CLIST_MODE_OVERWRITE | CLIST_MODE_VARLEN))){
+		return -EINVAL;	/* 通し番号で位置を決めるのはSPSCだけ */
+	}
+
+	if((mode & CLIST_MODE_INDEX) && ((clist_ctl->nr_node & (clist_ctl->nr_node - 1)) || (clist_ctl->nr_composed & (clist_ctl->nr_composed - 1)))){
+		return -EINVAL;	/* マスクで位置を求めるので2の累乗でなければならない */
+	}
+
+	if((mode & ~CLIST_MODE_LATENCY) != CLIST_MODE_SPSC && (clist_ctl->max_node > clist_ctl->nr_node || clist_ctl->shrink_period)){
+		return -EINVAL;	/* ノードをnodes[]の添字で引くモードはノードを足せない */
+	}
+
+	if((mode & (CLIST_MODE_MPSC | CLIST_MODE_OVERWRITE | CLIST_MODE_INDEX)) && clist_ctl->flush_ns){
+		return -EINVAL;	/* 半端なノードを作れないモードでは封をする期限を使えない */
+	}
+
+	if(clist_ctl->w_seq != 0 || clist_ctl->w_claim != 0 || clist_ctl->w_obj != 0 || clist_wnode(clist_ctl)->curr_ptr != clist_wnode(clist_ctl)->data){
+		return -EBUSY;	/* 既にpushされている */
+	}
+
+	if(mode & CLIST_MODE_INDEX){
+		clist_ctl->index_shift = __builtin_ctz(clist_ctl->nr_composed);
+		clist_ctl->index_mask = (unsigned long long)clist_ctl->nr_node * clist_ctl->nr_composed - 1;
+	}
+
+	clist_ctl->mode = mode;
+
+	return 0;
+}
+EXPORT_SYMBOL(clist_set_mode);
+
+/*
+	循環リストが満杯になる時に、COLDにする代わりにノードを足すようにする関数
+	@clist_ctl 管理用構造体のアドレス
+	@max_nodes ノード数の上限（nr_nodeと同じならノードを足さない）
+	return 成功：0　失敗：マイナスのエラーコード
+
+	足したノードはclist_free()まで解放しない 上限に達したら今まで通りCOLDになる
+	※生産者側から呼び出すこと MPSCモード、OVERWRITEモード、共有メモリの循環リストでは使えない
+*/
+int clist_set_growth_policy(struct clist_controller *clist_ctl, int max_nodes)
+{
+	if((clist_ctl->mode & ~CLIST_MODE_LATENCY) != CLIST_MODE_SPSC || clist_ctl->shared){	/* 共有メモリの外にはノードを足せない */
+		return -EINVAL;
+	}
+
+	if(max_nodes < clist_ctl->nr_node){
+		return -EINVAL;	/* 減らすことはできない */
+	}
+
+	clist_ctl->max_node = max_nodes;
+
+	return 0;
+}
+EXPORT_SYMBOL(clist_set_growth_policy);
+
+/*
+	pull待ちのノード数が少ない状態が続いたら、空きノードを循環リストから外してメモリを返すようにする関数
+	@clist_ctl 管理用構造体のアドレス
+	@min_nodes 縮める時に残すノード数の下限（2以上）
+	@period 何ノード書き込むごとに見直すか（0なら縮めない）
+	return 成功：0　失敗：マイナスのエラーコード
+
+	外したノードは、満杯になりそうな時にclist_set_growth_policy()の仕組みで（少なくとも元のノード数までは）つなぎ直す
+	※生産者側から呼び出すこと MPSCモード、OVERWRITEモード、共有メモリの循環リストでは使えない
+*/
+int clist_set_shrink_policy(struct clist_controller *clist_ctl, int min_nodes, int period)
+{
+	if((clist_ctl->mode & ~CLIST_MODE_LATENCY) != CLIST_MODE_SPSC || clist_ctl->shared){	/* 共有メモリの外にはノードを足せない */
+		return -EINVAL;
+	}
+
+	if(min_nodes < 2 || period < 0){
+		return -EINVAL;
+	}
+
+	clist_ctl->min_node = min_nodes;
+	clist_ctl->shrink_period = period;
+	clist_ctl->shrink_count = 0;
+	clist_ctl->shrink_peak = 0;
+
+	return 0;
+}
+EXPORT_SYMBOL(clist_set_shrink_policy);
+
+/*
+	LATENCYモードで記録した、ノードが完成してから読み切られるまでの時間のヒストグラムを返す関数
+	@clist_ctl 管理用構造体のアドレス
+	@counts バケットごとの回数を格納する配列
+	@nr_buckets countsの要素数（CLIST_LAT_NR_BUCKETS個あれば全部入る）
+	return 成功：格納したバケットの数　失敗：マイナスのエラーコード
+
+	ノード単位で数える（1つのノードに入っていたオブジェクトは全て同じ時間とみなす）
+	どのスレッドから呼んでもよいが、消費者がpullしている最中なら少し前の値になる
+*/
+int clist_get_latency_histogram(const struct clist_controller *clist_ctl, unsigned long long *counts, int nr_buckets)
+{
+	int i;
+
+	if(!(clist_ctl->mode & CLIST_MODE_LATENCY) || nr_buckets < 0){
+		return -EINVAL;
+	}
+
+	if(nr_buckets > CLIST_LAT_NR_BUCKETS){
+		nr_buckets = CLIST_LAT_NR_BUCKETS;
+	}
+
+	for(i = 0; i < nr_buckets; i++){
+		counts[i] = clist_load_relaxed(&clist_ctl->lat_hist[i]);
+	}
+
+	return nr_buckets;
+}
+EXPORT_SYMBOL(clist_get_latency_histogram);
+
+/*
+	コピーの方法を変える関数
+	@clist_ctl 管理構造体のアドレス
+	@policy CLIST_COPY_AUTO/CLIST_COPY_MEMCPY/CLIST_COPY_STREAM
+	return 成功:0 失敗:マイナスのエラーコード
+
+	AUTOでは8/16/32/64バイトのオブジェクトを固定長でコピーし、
+	消費者が別のコアで動ける時はCLIST_COPY_STREAM_MINバイト以上のノード単位の書き込みをnon-temporalストアにする
+	push/pullと並行に呼ばないこと
+*/
+int clist_set_copy_policy(struct clist_controller *clist_ctl, int policy)
+{
+	if(policy != CLIST_COPY_AUTO && policy != CLIST_COPY_MEMCPY && policy != CLIST_COPY_STREAM){
+		return -EINVAL;
+	}
+
+	clist_ctl->copy_policy = policy;
+
+	return 0;
+}
+EXPORT_SYMBOL(clist_set_copy_policy);
+
+/*
+	w_currを開いてから一定時間が経ったら、pushの中で封をして読めるようにする関数
+	@clist_ctl 管理用構造体のアドレス
+	@usec w_currに最初に書き込んでから封をするまでの時間（マイクロ秒 0なら封をしない）
+	return 成功：0　失敗：マイナスのエラーコード
+
+	nr_composedを小さくしなくても、書き込みが少ない時の遅延をusec程度に抑えられる
+	pushが止まっても、期限が来れば消費者がpull（clist_pull_wait()は期限で起きる）の中で代わりに封をする
+	その分、pushごとにw_commitのCASが1回増える
+	※生産者側から呼び出すこと MPSCモード、OVERWRITEモード、INDEXモードでは使えない
+*/
+int clist_set_flush_deadline(struct clist_controller *clist_ctl, int usec)
+{
+	if(clist_ctl->mode & (CLIST_MODE_MPSC | CLIST_MODE_OVERWRITE | CLIST_MODE_INDEX)){
+		return -EINVAL;
+	}
+
+	if(usec < 0){
+		return -EINVAL;
+	}
+
+	clist_wbegin(clist_ctl);	/* 消費者が封をしていたら先に片付ける */
+
+	clist_ctl->flush_ns = (long long)usec * 1000;
+	clist_store_relaxed(&clist_ctl->w_open, 0);	/* 次のpushから期限を数え直す */
+	clist_store_release(&clist_ctl->w_commit, clist_commit_word(clist_ctl->w_seq, clist_wnode(clist_ctl)->curr_ptr - clist_wnode(clist_ctl)->data));
+
+	return 0;
+}
+EXPORT_SYMBOL(clist_set_flush_deadline);
+
+/*
+	push/pullの統計を返す関数
+	@clist_ctl 管理用構造体のアドレス
+	@stats 統計を格納するアドレス
+	return 成功：0　失敗：マイナスのエラーコード
+
+	カウンタは書く側ごとに分けてあり、push/pullの途中で読むと生産者側と消費者側で少しずれることがある
+	どのスレッドから呼んでもよく、push/pullを止める必要は無い
+*/
+int clist_get_stats(const struct clist_controller *clist_ctl, struct clist_stats *stats)
+{
+	if(stats == NULL){
+		return -EINVAL;
+	}
+
+	stats->pushed_objects = clist_load_relaxed(&clist_ctl->wstats.objects);
+	stats->pushed_bytes = clist_load_relaxed(&clist_ctl->wstats.bytes);
+	stats->partial_pushes = clist_load_relaxed(&clist_ctl->wstats.partial);
+	stats->cold_transitions = clist_load_relaxed(&clist_ctl->wstats.cold);
+	stats->max_wait_length = clist_load_relaxed(&clist_ctl->wstats.max_wait_length);
+
+	stats->pulled_objects = clist_load_relaxed(&clist_ctl->rstats.objects);
+	stats->pulled_bytes = clist_load_relaxed(&clist_ctl->rstats.bytes);
+	stats->pull_end_calls = clist_load_relaxed(&clist_ctl->rstats.pull_end);
+
+	stats->full_ns = clist_load_relaxed(&clist_ctl->wstats.full_ns) + clist_load_relaxed(&clist_ctl->rstats.full_ns);
+
+	if(CLIST_IS_COLD(clist_ctl)){
+		stats->full_ns += clist_cold_elapsed(clist_ctl);	/* まだHOTに戻っていない分 */
+	}
+
+	return 0;
+}
+EXPORT_SYMBOL(clist_get_stats);
+
+/*
+	clist_get_latency_histogram()のバケットに入る時間の下限（ナノ秒）を返す関数
+	@bucket バケット番号
+*/
+unsigned long long clist_latency_bucket_ns(int bucket)
+{
+	if(bucket < (1 << CLIST_LAT_SUB_BITS)){
+		return bucket > 0 ? bucket : 0;
+	}
+
+	if(bucket >= CLIST_LAT_NR_BUCKETS){
+		bucket = CLIST_LAT_NR_BUCKETS - 1;
+	}
+
+	return (unsigned long long)((1 << CLIST_LAT_SUB_BITS) | (bucket & ((1 << CLIST_LAT_SUB_BITS) - 1)))
+		<< ((bucket >> CLIST_LAT_SUB_BITS) - 1);
+}
+EXPORT_SYMBOL(clist_latency_bucket_ns);
+
+/*
+	OVERWRITEモードで上書きされて読まれなかったオブジェクトの個数を返す関数
+	@clist_ctl 管理用構造体のアドレス
+	return 上書きされたオブジェクトの累計
+
+	※消費者側から呼び出すこと 読んでいたノードが取り返されたことには次にpullした時に気づくので、それまでは多めに数える
+*/
+unsigned long long clist_lost_objects(const struct clist_controller *clist_ctl)
+{
+	long long lost;
+
+	lost = clist_load_acquire(&clist_ctl->lost);
+
+	return lost > 0 ? (unsigned long long)lost : 0;
+}
+EXPORT_SYMBOL(clist_lost_objects);
+
+/*
+	循環リストに1オブジェクトだけデータを追加する関数
+	@data データが入っているアドレス
+	@clist_ctl 管理用構造体のアドレス
+	return 成功：1　失敗：マイナスのエラーコード、もしくは0
+*/
+int clist_push_one(const void *data, struct clist_controller *clist_ctl)
+{
+	int write_scope, ret;
+
+	if(clist_ctl->mode & CLIST_MODE_VARLEN){
+		return -EINVAL;
+	}
+
+	if(clist_ctl->mode & CLIST_MODE_MPSC){
+		return clist_count_partial(1, clist_mpsc_push(data, 1, clist_ctl), clist_ctl);
+	}
+
+	if(clist_ctl->mode & CLIST_MODE_OVERWRITE){
+		return clist_count_partial(1, clist_ow_push(data, 1, clist_ctl), clist_ctl);
+	}
+
+	if(clist_ctl->mode & CLIST_MODE_INDEX){
+		return clist_count_partial(1, clist_index_push(data, 1, clist_ctl), clist_ctl);
+	}
+
+	clist_wbegin(clist_ctl);
+	clist_grow(1, clist_ctl);
+
+	write_scope = clist_wscope(1, clist_ctl, NULL, NULL);
+
+	if(!clist_push_permitted(clist_ctl, write_scope)){
+		ret = -EAGAIN;	/* push禁止だったらエラー */
+	}
+	else if(write_scope){
+		clist_wmemcpy(data, 1, clist_ctl);
+		ret = 1;
+	}
+	else{
+		clist_set_cold(clist_ctl);	/* push禁止に設定 */
+		ret = 0;
+	}
+
+	clist_wdeadline(clist_ctl);
+
+	return clist_count_partial(1, ret, clist_ctl);
+}
+EXPORT_SYMBOL(clist_push_one);
+
+/*
+	循環リストに1オブジェクトだけデータを読み取る関数
+	@data データを格納するアドレス
+	@clist_ctl 管理用構造体のアドレス
+	return 成功：1　失敗：マイナスのエラーコード、もしくは0
+*/
+int clist_pull_one(void *data, struct clist_controller *clist_ctl)
+{
+	int read_scope;
+
+	if(clist_ctl->mode & CLIST_MODE_VARLEN){
+		return -EINVAL;
+	}
+
+	if(clist_ctl->mode & CLIST_MODE_OVERWRITE){
+		return clist_pull_done(1, clist_ow_pull(data, 1, clist_ctl), clist_ctl);
+	}
+
+	if(clist_ctl->mode & CLIST_MODE_INDEX){
+		read_scope = clist_index_pull(data, 1, clist_ctl);
+		clist_set_hot(clist_ctl);	/* push許可に設定 */
+
+		return clist_pull_done(1, read_scope, clist_ctl);
+	}
+
+	read_scope = clist_rscope(1, clist_ctl, NULL, NULL);
+
+	if(read_scope){
+		clist_rmemcpy(data, 1, clist_ctl);
+		clist_set_hot(clist_ctl);	/* push許可に設定 */
+
+		return clist_pull_done(1, 1, clist_ctl);
+	}
+	else{
+		return clist_pull_done(1, 0, clist_ctl);
+	}
+}
+EXPORT_SYMBOL(clist_pull_one);
+
+/*
+	SPSCモードで循環リストにデータを追加する関数（clist_push_order()の本体）
+	@data データが入っているアドレス
+	@n オブジェクトの個数
+	@clist_ctl 管理構造体のアドレス
+	return 成功：追加したオブジェクトの個数　失敗：マイナスのエラーコード
+*/
+static int clist_spsc_push(const void *data, int n, struct clist_controller *clist_ctl)
+{
+	int write_scope, n_first = 0, n_burst = 0;
+	int ret = 0;
+
+	clist_grow(n, clist_ctl);
+
+	write_scope = clist_wscope(n, clist_ctl, &n_first, &n_burst);
+
+	if(!clist_push_permitted(clist_ctl, write_scope)){
+		ret = -EAGAIN;	/* push禁止だったらエラー */
+	}
+	else if(n >= write_scope){
+		/* 現在のノードに書き込めるだけ書き込む */
+		if(n_first > 0){
+			clist_wmemcpy(data, n_first, clist_ctl);
+			ret += n_first;
+		}
+
+		if(clist_wfull(clist_ctl)){	/* w_currがr_currに追いついた */
+			clist_set_cold(clist_ctl);	/* push禁止に設定する */
+
+			return n_first;
+		}
+
+		/* ノード単位で書き込む */
+		if(n_burst > 0){
+			clist_wmemcpy_burst(data + objs_to_byte(clist_ctl, ret), n_burst, clist_ctl);
+			ret += n_burst * clist_ctl->nr_composed;
+		}
+	}
+	else{	/* n < write_scope */
+
+		if(n >= n_first){		/* 現在のノードに書き込めるだけ書き込む */
+
+			/* n_burstを再計算 */
+			n_burst = (n - n_first) / clist_ctl->nr_composed;
+
+			if(n_first > 0){
+				clist_wmemcpy(data, n_first, clist_ctl);
+				ret += n_first;
+			}
+
+			if(clist_wfull(clist_ctl)){	/* w_currがr_currに追いついた */
+				clist_set_cold(clist_ctl);	/* push禁止に設定する */
+
+				return n_first;
+			}
+
+			/* ノード単位で書き込む */
+			if(n_burst > 0){
+				clist_wmemcpy_burst(data + objs_to_byte(clist_ctl, ret), n_burst, clist_ctl);
+				ret += n_burst * clist_ctl->nr_composed;
+			}
+
+			/* 最後に残った半端なものを書き込む */
+			if(n - ret > 0){
+				clist_wmemcpy(data + objs_to_byte(clist_ctl, ret), n - ret, clist_ctl);
+				ret += n - ret;
+			}
+		}
+		else{	/* n < n_first */
+			/* nだけ書き込む */
+			clist_wmemcpy(data, n, clist_ctl);
+			ret += n;
+		}
+	}
+
+	return ret;
+}
+
+/*
+	循環リストにデータを追加する関数
+	@data データが入っているアドレス
+	@n オブジェクトの個数
+	return 成功：追加したオブジェクトの個数　失敗：マイナスのエラーコード
+
+	※この関数がlen以下の値を返した時は循環リストが一周しているのでユーザ側で再送するか、データ量を再検討する必要がある
+	  OVERWRITEモードでは一番古いノードを上書きして必ずn個追加する（上書きした個数はclist_lost_objects()で分かる）
+*/
+int clist_push_order(const void *data, int n, struct clist_controller *clist_ctl)
+{
+	int ret;
+
+	if(clist_ctl->mode & CLIST_MODE_VARLEN){
+		return -EINVAL;
+	}
+
+	if(clist_ctl->mode & CLIST_MODE_MPSC){
+		ret = clist_mpsc_push(data, n, clist_ctl);
+	}
+	else if(clist_ctl->mode & CLIST_MODE_OVERWRITE){
+		ret = clist_ow_push(data, n, clist_ctl);
+	}
+	else if(clist_ctl->mode & CLIST_MODE_INDEX){
+		ret = clist_index_push(data, n, clist_ctl);
+	}
+	else{
+		clist_wbegin(clist_ctl);
+		ret = clist_spsc_push(data, n, clist_ctl);
+		clist_wdeadline(clist_ctl);
+	}
+
+	return clist_count_partial(n, ret, clist_ctl);
+}
+EXPORT_SYMBOL(clist_push_order);
+
+/*
+	w_currの中に直接オブジェクトを書き込むための領域を予約する関数
+	@clist_ctl 管理用構造体のアドレス
+	@n 予約したいオブジェクトの個数
+	@count 実際に予約できたオブジェクトの個数を格納するアドレス
+	return 成功：書き込み先のアドレス　失敗：NULL（*countには0かマイナスのエラーコードが入る）
+
+	※予約できるのはw_currの中で連続している領域だけなので、*countはn以下になることがある
+	  書き込んだ後にclist_push_commit()を呼ぶまで消費者からは見えない MPSCモード、VARLENモードでは使えない
+	  flush_nsがある時は、clist_push_commit()を呼ぶまで消費者は期限切れの封をしない（必ずcommitすること）
+*/
+void *clist_push_reserve(struct clist_controller *clist_ctl, int n, int *count)
+{
+	int write_scope, n_first = 0;
+
+	if(clist_ctl->mode & (CLIST_MODE_MPSC | CLIST_MODE_VARLEN | CLIST_MODE_INDEX)){
+		*count = -EINVAL;
+		return NULL;
+	}
+
+	if((clist_ctl->mode & CLIST_MODE_OVERWRITE) && clist_filled_nodes(clist_ctl) == clist_ctl->nr_node){
+		clist_ow_reclaim(clist_ctl);	/* 満杯なら一番古いノードを取り返して予約する */
+	}
+
+	clist_wbegin(clist_ctl);	/* 予約した領域を消費者に封をさせない（clist_push_commit()で下ろす） */
+	clist_grow(n, clist_ctl);
+
+	write_scope = clist_pushable_objects(clist_ctl, &n_first, NULL);
+
+	if(!clist_push_permitted(clist_ctl, write_scope)){
+		clist_wdeadline(clist_ctl);
+		*count = -EAGAIN;	/* push禁止だったらエラー */
+		return NULL;
+	}
+
+	if(n_first == 0){
+		clist_wdeadline(clist_ctl);
+		clist_set_cold(clist_ctl);	/* w_currがr_currに追いついているのでpush禁止に設定する */
+		*count = 0;
+		return NULL;
+	}
+
+	*count = (n < n_first) ? n : n_first;
+
+	return clist_at(clist_ctl, clist_wnode(clist_ctl)->curr_ptr);
+}
+EXPORT_SYMBOL(clist_push_reserve);
+
+/*
+	clist_push_reserve()で予約した領域のうち書き込みが終わったオブジェクトを公開する関数
+	@clist_ctl 管理用構造体のアドレス
+	@n 書き込みが終わったオブジェクトの個数
+	return 成功：公開したオブジェクトの個数　失敗：マイナスのエラーコード
+
+	※nはclist_push_reserve()が返した*count以下であること
+*/
+int clist_push_commit(struct clist_controller *clist_ctl, int n)
+{
+	int curr_len;
+
+	if(clist_ctl->mode & (CLIST_MODE_MPSC | CLIST_MODE_VARLEN | CLIST_MODE_INDEX)){
+		return -EINVAL;
+	}
+
+	curr_len = clist_wnode(clist_ctl)->curr_ptr - clist_wnode(clist_ctl)->data;
+
+	if(n < 0 || objs_to_byte(clist_ctl, n) > clist_ctl->node_len - curr_len){
+		return -EINVAL;	/* w_currをはみ出す */
+	}
+
+	if(n > 0){
+		clist_wadvance(n, clist_ctl);
+	}
+
+	clist_wdeadline(clist_ctl);
+
+	return n;
+}
+EXPORT_SYMBOL(clist_push_commit);
+
+/*
+	clist_flush()で封をした半端なノードがある時のclist_pull_order()の本体
+	@data データを格納するアドレス
+	@n 読みたいオブジェクトの個数
+	@clist_ctl 管理用構造体のアドレス
+	return dataに格納したオブジェクトの個数
+
+	ノードごとにfillまで読むので、ノード単位のまとめ読みはしない 半端なノードを読み切ればclist_pull_order()は元に戻る
+*/
+static int clist_pull_partial(void *data, int n, struct clist_controller *clist_ctl)
+{
+	int ret = 0, n_first = 0;
+
+	while(ret < n && clist_pull_scope(clist_ctl, &clist_ctl->w_seq_cache, &n_first, NULL) > 0){
+		if(n_first > n - ret){
+			n_first = n - ret;
+		}
+
+		clist_rmemcpy(data + objs_to_byte(clist_ctl, ret), n_first, clist_ctl);
+		ret += n_first;
+	}
+
+	return ret;
+}
+
+/*
+	循環リストからlenだけデータを読む関数
+	@data データを格納するアドレス
+	@len データの長さ
+	return dataに格納したデータサイズ
+
+	※書き込みが完了したノードしか読まない仕様
+*/
+int clist_pull_order(void *data, int n, struct clist_controller *clist_ctl)
+{
+	int n_first = 0, n_burst = 0;
+	int ret = 0, read_scope;
+
+	if(clist_ctl->mode & CLIST_MODE_VARLEN){
+		return -EINVAL;
+	}
+
+	if(clist_ctl->mode & CLIST_MODE_OVERWRITE){
+		return clist_pull_done(n, clist_ow_pull(data, n, clist_ctl), clist_ctl);
+	}
+
+	if(clist_ctl->mode & CLIST_MODE_INDEX){
+		ret = clist_index_pull(data, n, clist_ctl);
+		clist_set_hot(clist_ctl);	/* COLDだったらpush許可に設定する */
+
+		return clist_pull_done(n, ret, clist_ctl);
+	}
+
+	/* 読める最大サイズを計算する */
+	read_scope = clist_rscope(n, clist_ctl, &n_first, &n_burst);
+
+	if(clist_ctl->r_partial != clist_ctl->w_partial_cache + clist_ctl->r_sealed){	/* 一杯になる前に封をしたノードがある */
+		ret = clist_pull_partial(data, n, clist_ctl);
+	}
+	else if(n >= read_scope){	/* 読める上限（read_scope）だけ読む */
+
+		if(n_first){
+			clist_rmemcpy(data, n_first, clist_ctl);
+			ret += n_first;
+		}
+
+		/* ノード単位で読む */
+		if(n_burst){
+			clist_rmemcpy_burst(data + objs_to_byte(clist_ctl, ret), n_burst, clist_ctl);
+			ret += n_burst * clist_ctl->nr_composed;
+		}
+	}
+	else{	/* n < read_scope */
+
+		if(n >= n_first){
+
+			/* n_burstを再計算 */
+			n_burst = (n - n_first) / clist_ctl->nr_composed;
+
+			/* 読み残しを読む */
+			if(n_first){
+				clist_rmemcpy(data, n_first, clist_ctl);
+				ret += n_first;
+			}
+
+			/* ノード単位で読む */
+			if(n_burst > 0){
+				clist_rmemcpy_burst(data + objs_to_byte(clist_ctl, ret), n_burst, clist_ctl);
+				ret += n_burst * clist_ctl->nr_composed;
+			}
+
+			/* 半端な長さのものを読む */
+			if(n - ret > 0){
+				clist_rmemcpy(data + objs_to_byte(clist_ctl, ret), n - ret, clist_ctl);
+				ret += n - ret;
+			}
+		}
+		else{	/* len < n_first */
+			clist_rmemcpy(data, n, clist_ctl);
+			ret += n;
+		}
+	}
+
+	clist_set_hot(clist_ctl);	/* COLDだったらpush許可に設定する */
+
+	return clist_pull_done(n, ret, clist_ctl);
+}
+EXPORT_SYMBOL(clist_pull_order);
+
+
+#ifndef CLIST_PORT_KERNEL	/* struct iovecとwritev()はユーザ空間だけ */
+/*
+	iovecの並びとノードの中の連続した領域の間でバイト列をコピーする関数
+	@node ノード側のアドレス
+	@iov iovecの配列
+	@idx 次にコピーするiovecの番号（コピーした分だけ進める）
+	@off iov[*idx]の中でコピー済みのバイト数（コピーした分だけ進める）
+	@len コピーするバイト数（iovecの残りの合計以下であること）
+	@to_node 1ならiovecからノードへ、0ならノードからiovecへ
+
+	オブジェクトがiovecの境目をまたいでもよい（ヘッダとペイロードを別々のバッファで渡せる）
+*/
+static void clist_iov_copy(void *node, const struct iovec *iov, int *idx, size_t *off, size_t len, int to_node)
+{
+	size_t chunk;
+
+	while(len > 0){
+		chunk = iov[*idx].iov_len - *off;
+
+		if(chunk > len){
+			chunk = len;
+		}
+
+		if(chunk == 0){
+			;	/* 長さ0のiovec（iov_baseがNULLのこともある）は飛ばす */
+		}
+		else if(to_node){
+			memcpy(node, iov[*idx].iov_base + *off, chunk);
+		}
+		else{
+			memcpy(iov[*idx].iov_base + *off, node, chunk);
+		}
+
+		node += chunk;
+		*off += chunk;
+		len -= chunk;
+
+		if(*off == iov[*idx].iov_len){	/* このiovecは使い切った */
+			(*idx)++;
+			*off = 0;
+		}
+	}
+}
+
+/*
+	iovecの長さの合計をオブジェクトの個数にする関数
+	@iov iovecの配列
+	@cnt iovecの個数
+	@clist_ctl 管理用構造体のアドレス
+	@exact 1なら合計がobject_sizeの倍数でなければエラーにする
+	return 成功：オブジェクトの個数　失敗：マイナスのエラーコード
+*/
+static int clist_iov_objects(const struct iovec *iov, int cnt, const struct clist_controller *clist_ctl, int exact)
+{
+	int i;
+	size_t total = 0;
+
+	if(cnt < 0 || (cnt > 0 && iov == NULL)){
+		return -EINVAL;
+	}
+
+	for(i = 0; i < cnt; i++){
+		total += iov[i].iov_len;
+	}
+
+	if(exact && total % clist_ctl->object_size){
+		return -EINVAL;	/* オブジェクトの途中で終わっている */
+	}
+
+	if(total / clist_ctl->object_size > INT_MAX){
+		return -EINVAL;
+	}
+
+	return (int)(total / clist_ctl->object_size);
+}
+
+/*
+	複数のバッファに分かれたデータをまとめて循環リストに追加する関数
+	@clist_ctl 管理用構造体のアドレス
+	@iov 書き込むバッファの配列（長さの合計がobject_sizeの倍数であること）
+	@cnt iovecの個数
+	return 成功：追加したオブジェクトの個数　失敗：マイナスのエラーコード、もしくは0（満杯）
+
+	空きの確認は呼び出しごとに1回だけで、バッファからノードへ直接コピーする（組み立て用のバッファは要らない）
+	clist_push_order()と同じく、空きが足りなければ入るだけ書いてその個数を返す
+	※SPSCモード（LATENCYモードとの併用は可）でのみ使える
+*/
+int clist_push_iov(struct clist_controller *clist_ctl, const struct iovec *iov, int cnt)
+{
+	int req, n, k, ret = 0, write_scope, idx = 0, curr_len;
+	size_t off = 0;
+
+	if((clist_ctl->mode & ~CLIST_MODE_LATENCY) != CLIST_MODE_SPSC){
+		return -EINVAL;
+	}
+
+	req = clist_iov_objects(iov, cnt, clist_ctl, 1);
+
+	if(req <= 0){
+		return req;
+	}
+
+	clist_wbegin(clist_ctl);
+	clist_grow(req, clist_ctl);
+
+	write_scope = clist_wscope(req, clist_ctl, NULL, NULL);
+
+	if(!clist_push_permitted(clist_ctl, write_scope)){
+		clist_wdeadline(clist_ctl);
+		return clist_count_partial(req, -EAGAIN, clist_ctl);	/* push禁止だったらエラー */
+	}
+
+	if(write_scope == 0){
+		clist_wdeadline(clist_ctl);
+		clist_set_cold(clist_ctl);	/* push禁止に設定 */
+		return clist_count_partial(req, 0, clist_ctl);
+	}
+
+	n = (req < write_scope) ? req : write_scope;
+
+	/* ノードの境目ごとに区切って書き込む（一杯になったノードはclist_wadvance()で封をする） */
+	while(ret < n){
+		curr_len = clist_wnode(clist_ctl)->curr_ptr - clist_wnode(clist_ctl)->data;
+		k = byte_to_objs(clist_ctl, (clist_ctl->node_len - curr_len));
+
+		if(k > n - ret){
+			k = n - ret;
+		}
+
+		clist_iov_copy(clist_at(clist_ctl, clist_wnode(clist_ctl)->curr_ptr), iov, &idx, &off, objs_to_byte(clist_ctl, k), 1);
+		clist_wadvance(k, clist_ctl);
+		ret += k;
+	}
+
+	clist_wdeadline(clist_ctl);
+
+	return clist_count_partial(req, ret, clist_ctl);
+}
+
+/*
+	循環リストから複数のバッファに読み分ける関数
+	@clist_ctl 管理用構造体のアドレス
+	@iov 読み込み先のバッファの配列（長さの合計に入るだけ読む）
+	@cnt iovecの個数
+	return 成功：読み込んだオブジェクトの個数　失敗：マイナスのエラーコード
+
+	読める量の確認は呼び出しごとに1回だけで、ノードからバッファへ直接コピーする
+	オブジェクトはバッファの境目をまたいで書かれることがある
+	※書き込みが完了したノードしか読まない VARLENモード、OVERWRITEモード、INDEXモードでは使えない
+*/
+int clist_pull_iov(struct clist_controller *clist_ctl, const struct iovec *iov, int cnt)
+{
+	int req, n, ret = 0, n_first = 0, read_scope, idx = 0;
+	size_t off = 0;
+
+	if(clist_ctl->mode & (CLIST_MODE_VARLEN | CLIST_MODE_OVERWRITE | CLIST_MODE_INDEX)){
+		return -EINVAL;
+	}
+
+	req = clist_iov_objects(iov, cnt, clist_ctl, 0);
+
+	if(req <= 0){
+		return req;
+	}
+
+	read_scope = clist_rscope(req, clist_ctl, NULL, NULL);
+
+	n = (req < read_scope) ? req : read_scope;
+
+	/* ノードごとにfillまで読む（clist_flush()で封をした半端なノードがあるとread_scopeより少なくなる） */
+	while(ret < n && clist_pull_scope(clist_ctl, &clist_ctl->w_seq_cache, &n_first, NULL) > 0){
+		if(n_first > n - ret){
+			n_first = n - ret;
+		}
+
+		clist_iov_copy(clist_rhead(clist_ctl), iov, &idx, &off, objs_to_byte(clist_ctl, n_first), 0);
+		clist_radvance(n_first, clist_ctl);
+		ret += n_first;
+	}
+
+	if(ret > 0){
+		clist_set_hot(clist_ctl);	/* COLDだったらpush許可に設定する */
+	}
+
+	return clist_pull_done(req, ret, clist_ctl);
+}
+
+/*
+	r_currから続くノードをオブジェクトn個分だけ読み進める関数
+	@n 読み進めるオブジェクトの個数（読めるオブジェクトの個数以下であること）
+	@clist_ctl 管理用構造体のアドレス
+
+	ノードごとにfillで区切ってclist_radvance()に渡すので、読み切ったノードは生産者に返される
+*/
+static void clist_rskip(int n, struct clist_controller *clist_ctl)
+{
+	int k;
+
+	while(n > 0){
+		k = byte_to_objs(clist_ctl, (clist_rnode(clist_ctl)->fill - clist_ctl->r_pos));
+
+		if(k > n){
+			k = n;
+		}
+
+		clist_radvance(k, clist_ctl);
+		n -= k;
+	}
+}
+
+/*
+	完成したノードを、コピーせずにファイルディスクリプタへ書き出す関数
+	@clist_ctl 管理用構造体のアドレス
+	@fd 書き出し先（ファイル、パイプ、ソケットなど）
+	@max_objects 書き出す最大オブジェクト数
+	return 成功：書き終えたオブジェクトの個数（読めるものが無ければ0）　失敗：マイナスのエラーコード
+
+	r_currから続くノードをiovecに並べて1回のwritev()で書き出す（メモリ上で隣接したノードは1つのiovecにまとめる）
+	ノードは書き終わってから生産者に返すので、書き出している間に上書きされることはない
+	writev()がオブジェクトの途中で戻った時は、書いたバイト数をr_fd_posに残して次の呼び出しでその続きから書く
+	（待たずに返すので、ノンブロッキングのfdが一杯なら-EAGAINを返す ストリームの中でオブジェクトが重複したり欠けたりはしない）
+	1回に書き出すのは最大でCLIST_FD_IOV個の連続した領域まで
+
+	※書き込みが完了したノードしか読まない 消費者側から呼び出すこと VARLENモード、OVERWRITEモード、INDEXモードでは使えない
+	  オブジェクトの途中まで書いた状態（r_fd_posが0でない）で他のpull関数を呼ぶと、そのオブジェクトの先頭がfdと重複する
+*/
+int clist_pull_to_fd(struct clist_controller *clist_ctl, int fd, int max_objects)
+{
+	int i, cnt = 0, nr_nodes, objs, total = 0, pos;
+	ssize_t written;
+	char *p;
+	struct clist_node *node;
+	struct iovec iov[CLIST_FD_IOV];
+
+	if(clist_ctl->mode & (CLIST_MODE_VARLEN | CLIST_MODE_OVERWRITE | CLIST_MODE_INDEX)){
+		return -EINVAL;
+	}
+
+	if(max_objects <= 0){
+		return max_objects == 0 ? 0 : -EINVAL;
+	}
+
+	clist_rscope(max_objects, clist_ctl, NULL, NULL);
+
+	/* 完成したノードをr_currから順にiovecに並べる（半端なノードはfillまで） */
+	nr_nodes = (int)(clist_ctl->w_seq_cache - clist_load_relaxed(&clist_ctl->r_seq));
+	node = clist_rnode(clist_ctl);
+	pos = clist_ctl->r_pos;
+
+	for(i = 0; i < nr_nodes && total < max_objects; i++){
+		objs = byte_to_objs(clist_ctl, (node->fill - pos));
+
+		if(objs > max_objects - total){
+			objs = max_objects - total;
+		}
+
+		p = clist_at(clist_ctl, node->data + pos);
+
+		if(cnt > 0 && (char *)iov[cnt - 1].iov_base + iov[cnt - 1].iov_len == p){
+			iov[cnt - 1].iov_len += objs_to_byte(clist_ctl, objs);	/* 前のノードとメモリ上で隣接している */
+		}
+		else if(cnt < CLIST_FD_IOV){
+			iov[cnt].iov_base = p;
+			iov[cnt].iov_len = objs_to_byte(clist_ctl, objs);
+			cnt++;
+		}
+		else{
+			break;	/* iovecが足りないので残りは次の呼び出しで書く */
+		}
+
+		total += objs;
+		node = clist_next(clist_ctl, node);
+		pos = 0;
+	}
+
+	if(total == 0){
+		return clist_pull_done(max_objects, 0, clist_ctl);
+	}
+
+	/* 前の呼び出しで先頭のオブジェクトを途中まで書いていたら、その続きから書く（先頭のiovecは必ずそのオブジェクトを含む） */
+	iov[0].iov_base = (char *)iov[0].iov_base + clist_ctl->r_fd_pos;
+	iov[0].iov_len -= clist_ctl->r_fd_pos;
+
+	do{
+		written = writev(fd, iov, cnt);
+	}while(written < 0 && errno == EINTR);
+
+	if(written < 0){
+		return -errno;	/* 何も書けていないのでノードもr_fd_posもそのまま */
+	}
+
+	/* 書き終えたオブジェクトだけを読み進め、途中まで書いたものはバイト数を残す */
+	written += clist_ctl->r_fd_pos;
+	objs = (int)(written / clist_ctl->object_size);
+	clist_ctl->r_fd_pos = (int)(written % clist_ctl->object_size);
+
+	if(objs > 0){
+		clist_rskip(objs, clist_ctl);	/* 書き終わったノードだけを生産者に返す */
+		clist_set_hot(clist_ctl);	/* COLDだったらpush許可に設定する */
+	}
+
+	return clist_pull_done(max_objects, objs, clist_ctl);
+}
+#endif	/* CLIST_PORT_KERNEL */
+
+/*
+	書き込みが完了したノードのうち一番古いもの（の読み残し）をコピーせずに参照する関数
+	@clist_ctl 管理用構造体のアドレス
+	@ptr 読み出し先のアドレスを格納するアドレス
+	@count 参照できるオブジェクトの個数を格納するアドレス（任意）
+	return 参照できるオブジェクトの個数（0なら*ptrはNULL）
+
+	※*ptrの中身はclist_pull_release()を呼ぶまで有効 書き換えてはいけない
+	  OVERWRITEモードでは参照中に生産者に上書きされることがあるので、clist_pull_release()の戻り値で確かめること
+*/
+int clist_pull_peek(struct clist_controller *clist_ctl, const void **ptr, int *count)
+{
+	int n_first = 0, n_burst = 0, ret;
+
+	if(clist_ctl->mode & (CLIST_MODE_VARLEN | CLIST_MODE_INDEX)){
+		return -EINVAL;
+	}
+
+	if(clist_ctl->mode & CLIST_MODE_OVERWRITE){
+		clist_ow_resync(clist_ctl);
+	}
+
+	if(clist_pullable_objects(clist_ctl, &n_first, &n_burst) == 0 && clist_rseal(clist_ctl)){
+		clist_pullable_objects(clist_ctl, &n_first, &n_burst);	/* 期限切れで封をしたw_currを参照する */
+	}
+
+	if(n_first > 0){
+		ret = n_first;	/* 読み残しがあればそこまで */
+	}
+	else if(n_burst > 0){
+		ret = clist_ctl->nr_composed;	/* ノード丸ごと */
+	}
+	else{
+		ret = 0;
+	}
+
+	*ptr = ret ? clist_rhead(clist_ctl) : NULL;
+
+	if(count){
+		*count = ret;
+	}
+
+	return ret;
+}
+EXPORT_SYMBOL(clist_pull_peek);
+
+/*
+	clist_pull_peek()で参照したオブジェクトを読み終わったことを通知する関数
+	@clist_ctl 管理用構造体のアドレス
+	@n 読み終わったオブジェクトの個数
+	return 成功：読み進めたオブジェクトの個数　失敗：マイナスのエラーコード
+
+	※nはclist_pull_peek()が返した個数以下であること ノードを読み切るとそのノードは生産者に返される
+	  OVERWRITEモードで参照中のノードが上書きされていたら-ESTALEを返すので、参照した中身は捨てること
+*/
+int clist_pull_release(struct clist_controller *clist_ctl, int n)
+{
+	const void *ptr;
+
+	if(clist_ctl->mode & CLIST_MODE_OVERWRITE){
+		clist_fence_acquire();	/* 参照した中身を読み終えてからr_seqを確かめる */
+
+		if(clist_ow_resync(clist_ctl)){
+			return -ESTALE;
+		}
+	}
+
+	if(n < 0 || n > clist_pull_peek(clist_ctl, &ptr, NULL)){
+		return -EINVAL;	/* 参照していない範囲まで進めようとしている */
+	}
+
+	if(n > 0){
+		clist_radvance(n, clist_ctl);
+		clist_set_hot(clist_ctl);	/* COLDだったらpush許可に設定する */
+	}
+
+	return n;
+}
+EXPORT_SYMBOL(clist_pull_release);
+
+/*
+	書き込み中のノード（w_curr）に封をして、一杯になる前に消費者から読めるようにする関数
+	@clist_ctl 管理用構造体のアドレス
+	return 成功：封をしたオブジェクトの個数（VARLENモードではバイト数 w_currが空なら0）　失敗：マイナスのエラーコード
+
+	clist_set_end()と違ってENDにはならず、生産者は次のノードから書き続けられる
+	封をしたノードは半端なまま1ノード分を使うので、多用すると循環リストに入るオブジェクト数が減る
+	※生産者側から呼び出すこと MPSCモード、OVERWRITEモード、INDEXモードでは使えない
+*/
+int clist_flush(struct clist_controller *clist_ctl)
+{
+	int len;
+
+	if(clist_ctl->mode & (CLIST_MODE_MPSC | CLIST_MODE_OVERWRITE | CLIST_MODE_INDEX)){
+		return -EINVAL;	/* 位置をオブジェクトの個数だけで決めているので、半端なノードを作れない */
+	}
+
+	clist_wbegin(clist_ctl);
+	len = clist_wflush(0, clist_ctl);
+	clist_wdeadline(clist_ctl);
+
+	if(clist_ctl->mode & CLIST_MODE_VARLEN){
+		return len;
+	}
+
+	return byte_to_objs(clist_ctl, len);
+}
+EXPORT_SYMBOL(clist_flush);
+
+/*
+	VARLENモードでw_currに封をする関数
+	@clist_ctl 管理用構造体のアドレス
+
+	封をすると満杯になる時は、growth policyがあれば先にノードを足す
+*/
+static void clist_record_seal(struct clist_controller *clist_ctl)
+{
+	if(clist_filled_nodes(clist_ctl) == clist_ctl->nr_node - 1){
+		clist_grow(clist_pushable_objects(clist_ctl, NULL, NULL), clist_ctl);
+	}
+
+	clist_wseal(clist_ctl);
+}
+
+/*
+	循環リストに可変長レコードを1つ追加する関数
+	@data レコードが入っているアドレス
+	@len レコードの長さ（バイト）
+	@clist_ctl 管理用構造体のアドレス
+	return 成功：len　失敗：マイナスのエラーコード、もしくは0（満杯）
 
-	※現在読み込み中のノードはwrite対象にはならない
+	レコードはノードをまたがない w_currの残りに入らなければw_currに封をして次のノードに書く
+	※VARLENモードでのみ使える lenは1以上、node_len - CLIST_RECORD_HDR_SIZE以下であること
 */
-int clist_pushable_objects(const struct clist_controller *clist_ctl, int *n_first, int *n_burst)
+int clist_push_record(const void *data, int len, struct clist_controller *clist_ctl)
 {
-	int curr_len, flen, burst;
+	int nr_free, curr_len, size;
+	unsigned int hdr;
 
-	if(clist_ctl->pull_wait_length == clist_ctl->nr_node){
-		/* w_currがr_currに追いついているなら0 */
-		flen = 0;
-		burst = 0;
+	if(!(clist_ctl->mode & CLIST_MODE_VARLEN) || len <= 0){
+		return -EINVAL;
 	}
-	else{
-		/* w_currに何バイトまで書き込みされているか計算 */
-		curr_len = clist_ctl->w_curr->curr_ptr - clist_ctl->w_curr->data;
-		burst = clist_ctl->nr_node - clist_ctl->pull_wait_length;
 
-		/* w_currにあと何バイト書き込めるか計算 */
-		if(clist_ctl->node_len > curr_len){
-#ifdef DEBUG
-			printf("clist_pushable_objects() curr_len:%d, burst:%d\n", curr_len, burst);
-#endif
-			flen = (clist_ctl->node_len - curr_len) / clist_ctl->object_size;
-			burst -= 1;	/* burstには書き込み中のノードも含んでいるため-1 */
-		}
-		else{	/* curr_ptr - dataは0未満にはならないのでここを通るということはcurr_ptr == data */
-			;
-		}
+	if(len > clist_ctl->node_len - CLIST_RECORD_HDR_SIZE){
+		return -EMSGSIZE;	/* 1つのノードに入らない */
 	}
 
-#ifdef DEBUG
-	printf("clist_pushable_objects() nr_node:%d - pull_wait_length:%d = %d\n", clist_ctl->nr_node, clist_ctl->pull_wait_length, clist_ctl->nr_node - clist_ctl->pull_wait_length);
-#endif
+	clist_wbegin(clist_ctl);
 
-	/* 引数のアドレスが有効なら代入する */
-	if(n_first){
-		*n_first = flen;
-	}
+	nr_free = clist_ctl->nr_node - clist_filled_nodes(clist_ctl);	/* w_currを含む空きノード数 */
 
-	if(n_burst){
-		*n_burst = burst;
+	if(!clist_push_permitted(clist_ctl, nr_free)){
+		clist_wdeadline(clist_ctl);
+		return clist_count_partial(1, -EAGAIN, clist_ctl);	/* push禁止だったらエラー */
 	}
 
-#ifdef DEBUG
-	printf("clist_pushable_objects flen:%d, burst:%d\n", flen, burst);
-#endif
+	if(nr_free == 0){
+		clist_wdeadline(clist_ctl);
+		clist_set_cold(clist_ctl);	/* w_currがr_currに追いついているのでpush禁止に設定する */
+		return clist_count_partial(1, 0, clist_ctl);
+	}
 
-	return flen + (burst * clist_ctl->nr_composed);
-}
+	curr_len = clist_wnode(clist_ctl)->curr_ptr - clist_wnode(clist_ctl)->data;
 
-/*
-	循環リスト内に存在するすべてのデータのサイズを返す関数
-	@clist_ctl 管理用構造体のアドレス
-	@n_first ノードに残っているバイト数を格納する関数（任意）
-	@n_burst ノード丸ごと読む場合、いくつのノードか（任意）
-	return w_currに存在しているオブジェクトの個数
+	if(CLIST_RECORD_HDR_SIZE + len > clist_ctl->node_len - curr_len){
+		/* w_currの残りに入らないので、ここまでで封をして次のノードに書く */
+		clist_record_seal(clist_ctl);
 
-	※この関数を呼び出すとclistはENDモードに突入する clist_free()の直前に呼び出すこと
-*/
-int clist_set_end(struct clist_controller *clist_ctl, int *n_first, int *n_burst)
-{
-	int first, burst;
+		if(clist_filled_nodes(clist_ctl) == clist_ctl->nr_node){
+			clist_wdeadline(clist_ctl);
+			clist_set_cold(clist_ctl);	/* 次のノードが空いていない */
+			return clist_count_partial(1, 0, clist_ctl);
+		}
 
-	clist_ctl->state = CLIST_STATE_END;	/* END状態に遷移させる */
+		curr_len = 0;
+	}
 
-	clist_pullable_objects(clist_ctl, &first, &burst);
+	hdr = len;
+	memcpy(clist_at(clist_ctl, clist_wnode(clist_ctl)->curr_ptr), &hdr, CLIST_RECORD_HDR_SIZE);
+	memcpy(clist_at(clist_ctl, clist_wnode(clist_ctl)->curr_ptr + CLIST_RECORD_HDR_SIZE), data, len);
 
-#ifdef DEBUG
-	printf("clist_set_cold pull_wait_length:%d first:%d n_burst:%d\n", clist_ctl->pull_wait_length, first, burst);
-#endif
+	/* 次のレコードの長さが揃う位置まで進める（ノードの末尾を超える分は詰めない） */
+	size = clist_record_size(len);
 
-	/* NULLでなかったら引数のアドレスに代入 */
-	if(n_first){
-		*n_first = first;
+	if(size > clist_ctl->node_len - curr_len){
+		size = clist_ctl->node_len - curr_len;
 	}
-	if(n_burst){
-		*n_burst = burst;
+
+	clist_wnode(clist_ctl)->curr_ptr += size;
+
+	clist_wstat_add(&clist_ctl->wstats.objects, 1, clist_ctl);
+	clist_wstat_add(&clist_ctl->wstats.bytes, len, clist_ctl);
+
+	if(clist_ctl->node_len - (curr_len + size) < CLIST_RECORD_HDR_SIZE){
+		clist_record_seal(clist_ctl);	/* もう1バイトのレコードも入らない */
 	}
 
-	return (int)(clist_ctl->w_curr->curr_ptr - clist_ctl->w_curr->data) / clist_ctl->object_size;
-}
+	clist_wdeadline(clist_ctl);
 
+	return len;
+}
+EXPORT_SYMBOL(clist_push_record);
 
 /*
-	メモリをallocして循環リストを構築する関数
-	@nr_node 循環リストの段数
-	@nr_composed 循環リスト１段に含まれるオブジェクトの数
+	循環リストから可変長レコードを1つ読む関数
+	@buf レコードを格納するアドレス
+	@size bufの大きさ（バイト）
+	@clist_ctl 管理用構造体のアドレス
+	return 成功：レコードの長さ（読めるレコードが無ければ0）　失敗：マイナスのエラーコード
 
-	return 成功:clist_controllerのアドレス 失敗:NULL
+	bufに入らない時は-EMSGSIZEを返し、レコードは読み進めない
+	※VARLENモードでのみ使える 封をされたノードのレコードしか読まない
 */
-struct clist_controller *clist_alloc(int nr_node, int nr_composed, int object_size)
+int clist_pull_record(void *buf, int size, struct clist_controller *clist_ctl)
 {
-	int i;
-	struct clist_controller *clist_ctl;
+	unsigned int hdr;
 
-	clist_ctl = (struct clist_controller *)malloc(sizeof(struct clist_controller));
+	if(!(clist_ctl->mode & CLIST_MODE_VARLEN)){
+		return -EINVAL;
+	}
 
-	if(clist_ctl == NULL){	/* エラー */
-		return NULL;
+	if(clist_ready_nodes(clist_ctl) == 0 && !clist_rseal(clist_ctl)){
+		return 0;
 	}
 
-	clist_ctl->pull_wait_length = 0;
+	memcpy(&hdr, clist_rhead(clist_ctl), CLIST_RECORD_HDR_SIZE);
 
-	clist_ctl->nr_node = nr_node;
-	clist_ctl->node_len = object_size * nr_composed;
+	if((int)hdr > size){
+		return -EMSGSIZE;
+	}
 
-	clist_ctl->nr_composed = nr_composed;
-	clist_ctl->object_size = object_size;
+	memcpy(buf, clist_rhead(clist_ctl) + CLIST_RECORD_HDR_SIZE, hdr);
 
-#ifdef DEBUG
-	printf("alloc_clist() nr_node:%d, node_len:%d\n", clist_ctl->nr_node, clist_ctl->node_len);
-#endif
+	clist_ctl->r_pos += clist_record_size((int)hdr);
 
-	/* メモリを確保 */
-	clist_ctl->nodes = (struct clist_node *)calloc(nr_node, sizeof(struct clist_node));
+	clist_rstat_add(&clist_ctl->rstats.objects, 1);
+	clist_rstat_add(&clist_ctl->rstats.bytes, hdr);
 
-	if(clist_ctl->nodes == NULL){	/* エラー */
-		return NULL;
+	if(clist_ctl->r_pos >= clist_rnode(clist_ctl)->fill){
+		clist_rnext(clist_ctl);	/* ノードを読み切った（末尾の詰め物はfillに含まれない） */
 	}
 
-	for(i = 0; i < clist_ctl->nr_node; i++){
-		clist_ctl->nodes[i].data = (void *)malloc(clist_ctl->node_len);
+	clist_set_hot(clist_ctl);	/* COLDだったらpush許可に設定する */
 
-		if(clist_ctl->nodes[i].data == NULL){	/* エラー */
-			return NULL;
-		}
-	}
+	return (int)hdr;
+}
+EXPORT_SYMBOL(clist_pull_record);
 
-	/* アドレスをつなぐ */
-	for(i = 0; i < clist_ctl->nr_node; i++){
-		if(i < clist_ctl->nr_node - 1){
-			clist_ctl->nodes[i].next_node = &clist_ctl->nodes[i + 1];
-		}
-		else{	/* 最後のcellは最初のcellにつなぐ */
-			clist_ctl->nodes[i].next_node = &clist_ctl->nodes[0];
-		}
+/*
+	循環リストから可変長レコードをまとめて読む関数
+	@buf レコードを格納するアドレス（レコードは長さ無しで詰めて格納する）
+	@size bufの大きさ（バイト）
+	@lens 格納したレコードの長さを順に格納する配列
+	@max_records lensの要素数
+	@clist_ctl 管理用構造体のアドレス
+	return 成功：格納したレコードの個数　失敗：マイナスのエラーコード
 
-		clist_ctl->nodes[i].curr_ptr = clist_ctl->nodes[i].data;
-	}
+	lensを先頭から足していけばbufの中のレコードの境界が分かる
+*/
+int clist_pull_records(void *buf, int size, int *lens, int max_records, struct clist_controller *clist_ctl)
+{
+	int nr = 0, off = 0, len;
 
-	/* 初期値を代入 */
-	clist_ctl->w_curr = &clist_ctl->nodes[0];
-	clist_ctl->r_curr = &clist_ctl->nodes[0];
+	while(nr < max_records){
+		len = clist_pull_record(buf + off, size - off, clist_ctl);
 
-	/* 入出力可能フラグ */
-	clist_ctl->state = CLIST_STATE_HOT;
+		if(len <= 0){
+			if(nr == 0 && len < 0){
+				return len;
+			}
+			break;
+		}
 
-	return clist_ctl;
+		lens[nr++] = len;
+		off += len;
+	}
+
+	return nr;
 }
+EXPORT_SYMBOL(clist_pull_records);
 
+#ifndef CLIST_PORT_KERNEL	/* futexとeventfdはユーザ空間だけ */
 /*
-	メモリを解放する関数
-	@clist_ctl ユーザがallocしたclist_controller構造体のアドレス
+	timeout_msからfutexのタイムアウト時刻を求める関数
+	@timeout_ms タイムアウト（ミリ秒） マイナスなら無制限
+	@deadline 時刻を格納するアドレス
+	return 時刻を格納したらdeadline、無制限ならNULL
 */
-void clist_free(struct clist_controller *clist_ctl)
+static struct timespec *clist_deadline(int timeout_ms, struct timespec *deadline)
 {
-	int i;
+	if(timeout_ms < 0){
+		return NULL;
+	}
 
-	/* データを解放 */
-	for(i = 0; i < clist_ctl->nr_node; i++){
-		free(clist_ctl->nodes[i].data);
+	clock_gettime(CLOCK_MONOTONIC, deadline);
+
+	deadline->tv_sec += timeout_ms / 1000;
+	deadline->tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+
+	if(deadline->tv_nsec >= 1000000000L){
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000L;
 	}
 
-	/* ノードを解放 */
-	free(clist_ctl->nodes);
-	free(clist_ctl);
+	return deadline;
 }
 
 /*
-	循環リストに1オブジェクトだけデータを追加する関数
-	@data データが入っているアドレス
+	clist_pull_wait()が起きる時刻を求める関数
 	@clist_ctl 管理用構造体のアドレス
-	return 成功：1　失敗：マイナスのエラーコード、もしくは0
+	@deadline timeout_msから求めた時刻（無制限ならNULL）
+	@ts 時刻を格納するアドレス
+	return deadlineとflush_nsの期限のうち早い方（w_currが開いていなければdeadline）
+
+	flush_nsの期限が過ぎているのに封をできなかった時は生産者がpushの途中なので、
+	pushの最後に生産者が封をするまでdeadlineで寝る
 */
-int clist_push_one(const void *data, struct clist_controller *clist_ctl)
+static const struct timespec *clist_pull_deadline(struct clist_controller *clist_ctl, const struct timespec *deadline, struct timespec *ts)
 {
-	int write_scope;
+	long long expire;
 
-	if(CLIST_IS_COLD(clist_ctl)){
-		return -EAGAIN;	/* push禁止だったらエラー */
+	if(clist_ctl->flush_ns == 0){
+		return deadline;
 	}
 
-	write_scope = clist_pushable_objects(clist_ctl, NULL, NULL);
+	clist_ctl->r_open = clist_load_relaxed(&clist_ctl->w_open);
 
-	if(write_scope){
-		clist_wmemcpy(data, 1, clist_ctl);
-		return 1;
+	if(clist_ctl->r_open == 0){
+		return deadline;	/* w_currを開いたら生産者に起こされる */
 	}
-	else{
-		clist_ctl->state = CLIST_STATE_COLD;	/* push禁止に設定 */
-		return 0;
+
+	expire = clist_ctl->r_open + clist_ctl->flush_ns;
+
+	if(expire <= clist_now_ns()){
+		return deadline;
+	}
+
+	ts->tv_sec = expire / 1000000000LL;
+	ts->tv_nsec = expire % 1000000000LL;
+
+	if(deadline && (deadline->tv_sec < ts->tv_sec || (deadline->tv_sec == ts->tv_sec && deadline->tv_nsec <= ts->tv_nsec))){
+		return deadline;
 	}
+
+	return ts;
 }
 
 /*
-	循環リストに1オブジェクトだけデータを読み取る関数
+	pullできるノードができるまで寝てから循環リストからデータを読む関数
 	@data データを格納するアドレス
+	@n 読み込む最大オブジェクト数
+	@timeout_ms タイムアウト（ミリ秒） マイナスなら無制限
 	@clist_ctl 管理用構造体のアドレス
-	return 成功：1　失敗：マイナスのエラーコード、もしくは0
+	return 成功：dataに格納したオブジェクトの個数（END状態なら0）　失敗：マイナスのエラーコード
+
+	生産者がノードを完成させた時にfutexで起こされるので、sleep()でポーリングするより早く、無駄に起きない
+	flush_nsがある時はw_currの期限でも起きるので、生産者がpushを止めていても期限が来れば封をして読む
 */
-int clist_pull_one(void *data, struct clist_controller *clist_ctl)
+int clist_pull_wait(void *data, int n, int timeout_ms, struct clist_controller *clist_ctl)
 {
-	int read_scope;
+	int ret;
+	struct timespec ts, flush_ts, *deadline;
+	const struct timespec *wake;
 
-	read_scope = clist_pullable_objects(clist_ctl, NULL, NULL);
+	deadline = clist_deadline(timeout_ms, &ts);
 
-	if(read_scope){
-		clist_rmemcpy(data, 1, clist_ctl);
-		clist_ctl->state = CLIST_STATE_HOT;	/* push許可に設定 */
+	while(1){
+		ret = clist_pull_order(data, n, clist_ctl);
 
-		return 1;
-	}
-	else{
-		return 0;
+		if(ret != 0 || CLIST_IS_END(clist_ctl)){
+			return ret;
+		}
+
+		wake = clist_pull_deadline(clist_ctl, deadline, &flush_ts);
+
+		if(clist_futex_wait(&clist_ctl->r_futex, &clist_ctl->r_waiters, wake, clist_pull_ready_open, clist_ctl) < 0 && wake == deadline){
+			return -ETIMEDOUT;	/* flush_nsの期限が過ぎただけなら、もう一度読んで封をする */
+		}
 	}
 }
 
 /*
-	循環リストにデータを追加する関数
+	空きができるのを待ちながら循環リストにn個全てのデータを追加する関数
 	@data データが入っているアドレス
 	@n オブジェクトの個数
-	return 成功：追加したオブジェクトの個数　失敗：マイナスのエラーコード
+	@timeout_ms タイムアウト（ミリ秒） マイナスなら無制限
+	@clist_ctl 管理用構造体のアドレス
+	return 成功：追加したオブジェクトの個数（タイムアウトしたらそれまでに追加できた個数）　失敗：マイナスのエラーコード
 
-	※この関数がlen以下の値を返した時は循環リストが一周しているのでユーザ側で再送するか、データ量を再検討する必要がある
+	消費者がノードを読み切った時にfutexで起こされる
 */
-int clist_push_order(const void *data, int n, struct clist_controller *clist_ctl)
+int clist_push_wait(const void *data, int n, int timeout_ms, struct clist_controller *clist_ctl)
 {
-	int i;
-	int write_scope, n_first = 0, n_burst = 0;
-	int ret = 0;
+	int ret = 0, pushed;
+	struct timespec ts, *deadline;
 
-	write_scope = clist_pushable_objects(clist_ctl, &n_first, &n_burst);
+	deadline = clist_deadline(timeout_ms, &ts);
 
-	if(CLIST_IS_COLD(clist_ctl)){
-		ret = -EAGAIN;	/* push禁止だったらエラー */
-	}
-	else if(n >= write_scope){
-#ifdef DEBUG
-		printf("clist_push() 1st-if, n:%d, write_scope:%d, n_first:%d, n_burst:%d\n", n, write_scope, n_first, n_burst);
-#endif
+	while(ret < n){
+		pushed = clist_push_order(data + objs_to_byte(clist_ctl, ret), n - ret, clist_ctl);
 
-		/* 現在のノードに書き込めるだけ書き込む */
-		if(n_first > 0){
-			clist_wmemcpy(data, n_first, clist_ctl);
-			ret += n_first;
+		if(pushed > 0){
+			ret += pushed;
+			continue;
 		}
 
-		if(clist_ctl->w_curr == clist_ctl->r_curr){
-#ifdef DEBUG
-			printf("clist_push() w_curr == r_curr. alloc more memory or retry. pull_wait_length:%d\n", clist_ctl->pull_wait_length);
-#endif
-			clist_ctl->state = CLIST_STATE_COLD;	/* push禁止に設定する */
+		if(pushed < 0 && pushed != -EAGAIN){
+			return ret ? ret : pushed;
+		}
 
-			return n_first;
+		if(CLIST_IS_END(clist_ctl)){
+			break;
 		}
 
-		/* ノード単位で書き込む */
-		for(i = 0; i < n_burst; i++){
-			clist_wmemcpy(data + objs_to_byte(clist_ctl, ret), clist_ctl->nr_composed, clist_ctl);
-			ret += clist_ctl->nr_composed;
+		if(clist_futex_wait(&clist_ctl->w_futex, &clist_ctl->w_waiters, deadline, clist_push_ready, clist_ctl) < 0){
+			return ret ? ret : -ETIMEDOUT;
 		}
 	}
-	else{	/* n < write_scope */
 
-		if(n >= n_first){		/* 現在のノードに書き込めるだけ書き込む */
+	return ret;
+}
 
-			/* n_burstを再計算 */
-			n_burst = (n - n_first) / clist_ctl->nr_composed;
-#ifdef DEBUG
-			printf("clist_push() 2nd-if, n:%d, write_scope:%d, n_first:%d, n_burst:%d\n", n, write_scope, n_first, n_burst);
-#endif
+/*
+	readable fd/writable fdを通知するpull待ちのノード数を設定する関数
+	@clist_ctl 管理用構造体のアドレス
+	@low pull待ちのノード数がlow以下になったらwritable fdに通知する（初期値：nr_node - 1）
+	@high pull待ちのノード数がhigh以上になったらreadable fdに通知する（初期値：1）
+	return 成功：0　失敗：マイナスのエラーコード
 
-			if(n_first > 0){
-				clist_wmemcpy(data, n_first, clist_ctl);
-				ret += n_first;
-			}
+	highを大きくすると消費者を起こす回数が減り、まとめて読めるようになる
+*/
+int clist_set_watermark(struct clist_controller *clist_ctl, int low, int high)
+{
+	if(low < 0 || low >= clist_ctl->nr_node || high < 1 || high > clist_ctl->nr_node){
+		return -EINVAL;
+	}
 
-			if(clist_ctl->w_curr == clist_ctl->r_curr){
-#ifdef DEBUG
-				printf("clist_push() w_curr == r_curr. alloc more memory or retry. pull_wait_length:%d\n", clist_ctl->pull_wait_length);
-#endif
-				clist_ctl->state = CLIST_STATE_COLD;	/* push禁止に設定する */
+	clist_ctl->wr_mark = low;
+	clist_ctl->rd_mark = high;
 
-				return n_first;
-			}
+	return 0;
+}
 
-			/* ノード単位で書き込む */
-			for(i = 0; i < n_burst; i++){
-				clist_wmemcpy(data + objs_to_byte(clist_ctl, ret), clist_ctl->nr_composed, clist_ctl);
-				ret += clist_ctl->nr_composed;
-			}
+/*
+	eventfdを作る関数
+	@fd_p rd_fdかwr_fdのアドレス
+	@armed_p rd_armedかwr_armedのアドレス
+	return 成功：eventfd　失敗：マイナスのエラーコード
+*/
+static int clist_get_eventfd(int *fd_p, int *armed_p)
+{
+	int fd;
 
-			/* 最後に残った半端なものを書き込む */
-			if(n - ret > 0){
-				clist_wmemcpy(data + objs_to_byte(clist_ctl, ret), n - ret, clist_ctl);
-				ret += n - ret;
-			}
-		}
-		else{	/* n < n_first */
-			/* nだけ書き込む */
-			printf("ret:%d, n:%d\n", ret, n);
+	if(*fd_p >= 0){	/* 作成済み */
+		return *fd_p;
+	}
 
-			clist_wmemcpy(data, n, clist_ctl);
-			ret += n;
-		}
+	fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if(fd < 0){
+		return -errno;
 	}
 
-#ifdef DEBUG
-	printf("n:%d ret:%d\n", n, ret);
-#endif
+	clist_store_mb(armed_p, 1);
+	clist_store_release(fd_p, fd);
 
-	return ret;
+	return fd;
 }
 
 /*
-	循環リストからlenだけデータを読む関数
-	@data データを格納するアドレス
-	@len データの長さ
-	return dataに格納したデータサイズ
+	pull待ちのノード数がhigh watermark以上になった時に通知されるeventfdを返す関数
+	@clist_ctl 管理用構造体のアドレス
+	return 成功：ファイルディスクリプタ　失敗：マイナスのエラーコード
 
-	※書き込みが完了したノードしか読まない仕様
+	epollにEPOLLINで登録して使う 通知されたらread(2)でカウンタを消してから、pullできなくなるまで読むこと
+	（high watermark未満まで読むと次の通知が有効になる） fdはclist_free()で閉じられる
 */
-int clist_pull_order(void *data, int n, struct clist_controller *clist_ctl)
+int clist_get_readable_fd(struct clist_controller *clist_ctl)
 {
-	int i, n_first = 0, n_burst = 0;
-	int ret = 0, read_scope;
-
-	/* 読める最大サイズを計算する */
-	read_scope = clist_pullable_objects(clist_ctl, &n_first, &n_burst);
-
+	int fd;
 
-	if(n >= read_scope){	/* 読める上限（read_scope）だけ読む */
-
-		if(n_first){
-			clist_rmemcpy(data, n_first, clist_ctl);
-			ret += n_first;
-		}
+	if(clist_ctl->shared){
+		return -EOPNOTSUPP;	/* fdは他のプロセスと共有できない */
+	}
 
-		/* ノード単位で読む */
-		if(n_burst){
+	fd = clist_get_eventfd(&clist_ctl->rd_fd, &clist_ctl->rd_armed);
 
-			for(i = 0; i < n_burst; i++){
-				clist_rmemcpy(data + objs_to_byte(clist_ctl, ret), clist_ctl->nr_composed, clist_ctl);
-				ret += clist_ctl->nr_composed;
-			}
-		}
+	if(fd >= 0){
+		clist_signal_readable(clist_ctl);	/* 既にたまっていればすぐに通知する */
 	}
-	else{	/* n < read_scope */
-
-		if(n >= n_first){
 
-			/* n_burstを再計算 */
-			n_burst = (n - n_first) / clist_ctl->nr_composed;
+	return fd;
+}
 
-			/* 読み残しを読む */
-			if(n_first){
-				clist_rmemcpy(data, n_first, clist_ctl);
-				ret += n_first;
-			}
-#ifdef DEBUG
-			printf("pick_node() loop number:%d\n", n_burst);
-#endif
+/*
+	pull待ちのノード数がlow watermark以下になった時に通知されるeventfdを返す関数
+	@clist_ctl 管理用構造体のアドレス
+	return 成功：ファイルディスクリプタ　失敗：マイナスのエラーコード
 
-			/* ノード単位で読む */
-			for(i = 0; i < n_burst; i++){
-				clist_rmemcpy(data + objs_to_byte(clist_ctl, ret), clist_ctl->nr_composed, clist_ctl);
-				ret += clist_ctl->nr_composed;
-			}
-#ifdef DEBUG
-			printf("pick_node() odd number:%d\n", n - ret);
-#endif
+	epollにEPOLLINで登録して使う 通知されたらread(2)でカウンタを消してからpushすること
+	（low watermarkを超えるまで書くと次の通知が有効になる） fdはclist_free()で閉じられる
+*/
+int clist_get_writable_fd(struct clist_controller *clist_ctl)
+{
+	int fd;
 
-			/* 半端な長さのものを読む */
-			if(n - ret > 0){
-				clist_rmemcpy(data + objs_to_byte(clist_ctl, ret), n - ret, clist_ctl);
-				ret += n - ret;
-			}
-		}
-		else{	/* len < n_first */
-			clist_rmemcpy(data, n, clist_ctl);
-			ret += n;
-		}
+	if(clist_ctl->shared){
+		return -EOPNOTSUPP;	/* fdは他のプロセスと共有できない */
 	}
 
-	if(CLIST_IS_COLD(clist_ctl)){
-		clist_ctl->state = CLIST_STATE_HOT;	/* push許可に設定する */
+	fd = clist_get_eventfd(&clist_ctl->wr_fd, &clist_ctl->wr_armed);
+
+	if(fd >= 0){
+		clist_signal_writable(clist_ctl);	/* 既に空いていればすぐに通知する */
 	}
 
-	return ret;
+	return fd;
 }
-
+#endif	/* CLIST_PORT_KERNEL */
 
 /*
 	循環リストからw_currのノードからデータを読む関数
@@ -529,12 +3858,20 @@ int clist_pull_end(void *data, struct clist_controller *clist_ctl)
 {
 	int len;
 
-	len = clist_ctl->w_curr->curr_ptr - clist_ctl->w_curr->data;
+	if(clist_ctl->mode & CLIST_MODE_INDEX){
+		return clist_index_pull_end(data, clist_ctl);
+	}
+
+	len = clist_wnode(clist_ctl)->curr_ptr - clist_wnode(clist_ctl)->data;
 
 	if(CLIST_IS_END(clist_ctl)){
 
-		memcpy(data, clist_ctl->w_curr->data, len);
-		clist_ctl->w_curr->curr_ptr -= len;
+		memcpy(data, clist_at(clist_ctl, clist_wnode(clist_ctl)->data), len);
+		clist_wnode(clist_ctl)->curr_ptr -= len;
+
+		clist_rstat_add(&clist_ctl->rstats.objects, byte_to_objs(clist_ctl, len));
+		clist_rstat_add(&clist_ctl->rstats.bytes, len);
+		clist_rstat_add(&clist_ctl->rstats.pull_end, 1);
 
 		return byte_to_objs(clist_ctl, len);
 	}
@@ -542,5 +3879,6 @@ int clist_pull_end(void *data, struct clist_controller *clist_ctl)
 		return -ECANCELED;
 	}
 }
+EXPORT_SYMBOL(clist_pull_end);
 
 
@@ -2,40 +2,278 @@
 #define CLIST_STATE_HOT	1
 #define CLIST_STATE_END	2
 
+/* clist_set_mode()で指定する動作モード */
+#define CLIST_MODE_SPSC	0x0	/* 生産者1つ、消費者1つ（デフォルト） */
+#define CLIST_MODE_MPSC	0x1	/* 生産者複数、消費者1つ */
+#define CLIST_MODE_OVERWRITE	0x2	/* 満杯の時は一番古いノードを上書きする（MPSCとは併用できない） */
+#define CLIST_MODE_VARLEN	0x4	/* 可変長レコードをclist_push_record()/clist_pull_record()で読み書きする（SPSCのみ） */
+#define CLIST_MODE_LATENCY	0x8	/* ノードが完成してから読み切られるまでの時間をヒストグラムに記録する（他のモードと併用できる） */
+#define CLIST_MODE_INDEX	0x10	/* ノードをnext_nodeでたどらず、オブジェクトの通し番号とマスクで位置を求める（SPSCのみ、段数と1段の数は2の累乗） */
+#define CLIST_MODE_MASK	(CLIST_MODE_MPSC | CLIST_MODE_OVERWRITE | CLIST_MODE_VARLEN | CLIST_MODE_LATENCY | CLIST_MODE_INDEX)
 
-#define CLIST_IS_HOT(ctl)	(ctl->state == CLIST_STATE_HOT ? 1 : 0)
-#define CLIST_IS_COLD(ctl)	(ctl->state == CLIST_STATE_COLD ? 1 : 0)
-#define CLIST_IS_END(ctl)	(ctl->state == CLIST_STATE_END ? 1 : 0)
+#define CLIST_CACHELINE_SIZE	64	/* ノードのデータ領域を揃える境界（バイト） */
+
+/* clist_set_copy_policy()で指定するコピーの方法 */
+#define CLIST_COPY_AUTO	0	/* object_sizeとnode_lenから選ぶ（デフォルト） */
+#define CLIST_COPY_MEMCPY	1	/* 常にmemcpy（比較用） */
+#define CLIST_COPY_STREAM	2	/* AUTOに加えて、ノード単位の書き込みは大きさによらずnon-temporalストアにする */
+
+#define CLIST_COPY_STREAM_MIN	(256 * 1024)	/* AUTOでノード単位の書き込みをnon-temporalストアにする大きさ（バイト） */
+
+#define CLIST_FD_IOV	64	/* clist_pull_to_fd()が1回のwritev()に並べるiovecの最大数（隣接したノードは1つにまとめる） */
+
+/* w_commitの下位32ビット（上位32ビットはw_currの通し番号w_seqの下位32ビット） */
+#define CLIST_COMMIT_BUSY	0x80000000ULL	/* 生産者がpushの途中（消費者は封をしない） */
+#define CLIST_COMMIT_SEALED	0x40000000ULL	/* flush_nsの期限切れで消費者が封をした（生産者は次のpushで次のノードに移る） */
+#define CLIST_COMMIT_LEN	0x3fffffffULL	/* w_currに書き込み終わったバイト数 */
+
+
+/*
+	生産者スレッドと消費者スレッドの間でカーソルを受け渡すためのアトミック操作
+	（single-producer/single-consumerであればロック無しでpush/pullを並行に実行できる）
+*/
+#define clist_load_relaxed(p)	__atomic_load_n(p, __ATOMIC_RELAXED)
+#define clist_load_acquire(p)	__atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define clist_store_relaxed(p, v)	__atomic_store_n(p, v, __ATOMIC_RELAXED)
+#define clist_store_release(p, v)	__atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define clist_cmpxchg(p, old, new)	__sync_bool_compare_and_swap(p, old, new)
+#define clist_try_cmpxchg(p, oldp, new)	__atomic_compare_exchange_n(p, oldp, new, 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)	/* 失敗すると*oldpに現在値が入る */
+#define clist_add_return(p, v)	__atomic_add_fetch(p, v, __ATOMIC_ACQ_REL)
+#define clist_add_relaxed(p, v)	__atomic_add_fetch(p, v, __ATOMIC_RELAXED)
+#define clist_load_mb(p)	__atomic_load_n(p, __ATOMIC_SEQ_CST)
+#define clist_store_mb(p, v)	__atomic_store_n(p, v, __ATOMIC_SEQ_CST)
+#define clist_fence()	__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define clist_fence_acquire()	__atomic_thread_fence(__ATOMIC_ACQUIRE)	/* 手前の読み込みを後ろの読み書きより先に済ませる */
+
+
+#define CLIST_IS_HOT(ctl)	(clist_load_acquire(&ctl->state) == CLIST_STATE_HOT ? 1 : 0)
+#define CLIST_IS_COLD(ctl)	(clist_load_acquire(&ctl->state) == CLIST_STATE_COLD ? 1 : 0)
+#define CLIST_IS_END(ctl)	(clist_load_acquire(&ctl->state) == CLIST_STATE_END ? 1 : 0)
 
 
-#define clist_wlen(ctl)	ctl->pull_wait_length
 #define objs_to_byte(ctl, n)	(ctl->object_size * n)
 #define byte_to_objs(ctl, byte)	(byte / ctl->object_size)
 
+/* VARLENモードのレコードは長さ（unsigned int）の後にデータが続き、CLIST_RECORD_ALIGNバイト境界まで詰める */
+#define CLIST_RECORD_ALIGN	8
+#define CLIST_RECORD_HDR_SIZE	((int)sizeof(unsigned int))
+#define clist_record_size(len)	(((len) + CLIST_RECORD_HDR_SIZE + CLIST_RECORD_ALIGN - 1) & ~(CLIST_RECORD_ALIGN - 1))
+
+
+/*
+	ノードとデータ領域はポインタではなくclist_controllerの先頭からのオフセットで指す
+	（clist_alloc_shared()で共有メモリに置いた時に、プロセスごとにマップされるアドレスが違っても同じ値で指せる）
+*/
+#define clist_at(ctl, off)	((void *)((char *)(ctl) + (off)))
+#define clist_off(ctl, p)	((long)((char *)(p) - (char *)(ctl)))
+#define clist_node_at(ctl, off)	((struct clist_node *)clist_at(ctl, off))
+#define clist_nodes(ctl)	clist_node_at(ctl, (ctl)->nodes)
+#define clist_next(ctl, node)	clist_node_at(ctl, (node)->next_node)
+#define clist_wnode(ctl)	clist_node_at(ctl, (ctl)->w_curr)
+#define clist_rnode(ctl)	clist_node_at(ctl, (ctl)->r_curr)
+
+/*
+	LATENCYモードのヒストグラム（対数線形）
+	8ns未満は1nsごと、それ以上は2の累乗ごとの区間をさらに2^CLIST_LAT_SUB_BITS個に分ける（誤差は1/8以内）
+	2^40ns（約18分）まで数え、それより長いものは最後のバケットに入れる 各バケットの下限はclist_latency_bucket_ns()で分かる
+*/
+#define CLIST_LAT_SUB_BITS	3
+#define CLIST_LAT_MAX_BITS	40
+#define CLIST_LAT_NR_BUCKETS	((CLIST_LAT_MAX_BITS - CLIST_LAT_SUB_BITS + 1) << CLIST_LAT_SUB_BITS)
+
+#define CLIST_SHARED_MAGIC	0x636c7374	/* clist_alloc_shared()で初期化が終わった共有メモリの目印 */
 
 /* 循環リストのノード */
 struct clist_node{
-	void *data;		/* ここにメモリを確保する */
-	struct clist_node *next_node;
+	long data;		/* ここにメモリを確保する（オフセット） */
+	long next_node;	/* 次のノード（オフセット） */
 
-	void *curr_ptr;	/* dataに次に格納するべきアドレス */
+	long curr_ptr;	/* dataに次に格納するべき位置（オフセット 生産者だけが使う） */
+	int fill;		/* 封をした時に書き込まれていたバイト数（VARLENモード以外では常にnode_len） */
+
+	/* MPSCモードでのみ使用 */
+	int committed;	/* 書き込みが終わったオブジェクトの個数 */
+	int sealed;	/* 全オブジェクトの書き込みが終わったら1 */
+
+	long long stamp;	/* LATENCYモードで封をした時刻（CLOCK_MONOTONIC、ナノ秒） */
 };
 
-/* 循環リスト管理用構造体 */
+/* clist_set_growth_policy()で後から足したノードの塊 */
+struct clist_chunk{
+	struct clist_chunk *next;	/* 前に足した塊 */
+	void *slab;		/* 塊の全ノードのデータ領域 */
+	struct clist_node nodes[];
+};
+
+/* clist_get_stats()で返す統計（clist_alloc()からの累計） */
+struct clist_stats{
+	unsigned long long pushed_objects, pushed_bytes;	/* VARLENモードではレコードの数とデータのバイト数 */
+	unsigned long long pulled_objects, pulled_bytes;
+	unsigned long long partial_pushes;	/* 要求した分を全部は書けなかったpushの回数（1つも書けなかった時も含む） */
+	unsigned long long cold_transitions;	/* 満杯でCOLDになった回数 */
+	unsigned long long full_ns;	/* COLDだった時間の合計（ナノ秒 今COLDならその分も含む） */
+	unsigned long long pull_end_calls;	/* END状態でclist_pull_end()を呼んだ回数 */
+	int max_wait_length;	/* pull待ちのノード数の最大値 */
+};
+
+/*
+	clist_stats の元になるカウンタ
+	生産者と消費者がお互いのキャッシュラインを書き換えないように、書く側ごとに分けて揃える
+*/
+struct clist_wstats{	/* 生産者だけが書く（MPSCモードでは生産者同士でアトミックに加算する） */
+	unsigned long long objects, bytes;
+	unsigned long long partial, cold;
+	unsigned long long full_ns;	/* 生産者がCOLDからHOTに戻した分 */
+	long long cold_since;	/* 最後にCOLDになった時刻 */
+	int max_wait_length;
+} __attribute__((aligned(CLIST_CACHELINE_SIZE)));
+
+struct clist_rstats{	/* 消費者だけが書く */
+	unsigned long long objects, bytes;
+	unsigned long long full_ns;	/* 消費者がCOLDからHOTに戻した分 */
+	unsigned long long pull_end;
+} __attribute__((aligned(CLIST_CACHELINE_SIZE)));
+
+/*
+	循環リスト管理用構造体
+	作った後はほとんど書き換えないもの、生産者だけが書くもの、消費者だけが書くもの、通知用のものをそれぞれ別のキャッシュラインに置く
+	（push/pullのたびに書くメンバが相手側の読むキャッシュラインに乗っていると、1回ごとにラインがコア間を行き来する）
+*/
 struct clist_controller{
-	int state;		/* CLIST_STATE_COLD:循環リストに対しての入出力禁止 CLIST_STATE_HOT:循環リストに対しての入出力可能*/
+	/* ここから作った後はほとんど書き換えない（生産者と消費者の両方が毎回読む） */
+	int mode;		/* CLIST_MODE_* */
 
-	int pull_wait_length;	/* pull待ちのnodeの数 */
 	int nr_node, node_len;
 	int nr_composed, object_size;
+	int max_node;	/* clist_set_growth_policy()で増やせるノード数の上限（nr_nodeと同じなら増やさない） */
+
+	/*
+		copy_policy:CLIST_COPY_*　copy_kind:object_sizeで選んだ固定長のコピー関数の番号
+		copy_stream:消費者が別のコアで動けるならノード単位の書き込みをnon-temporalストアにする
+		（共有メモリでもプロセスごとに引けるように、関数ポインタではなく番号で持つ）
+	*/
+	int copy_policy, copy_kind, copy_stream;
+
+	long nodes;		/* ノードの配列（オフセット） */
+	void *slab;		/* 全ノードのデータ領域をまとめて確保した領域（clist_alloc_shared()で作った時はNULL） */
+	struct clist_chunk *chunks;	/* 後から足したノード（最後に足したものが先頭） */
+
+	/*
+		clist_alloc_shared()で共有メモリに置いた時だけ使う
+		magic:初期化が終わったらCLIST_SHARED_MAGIC shared:マップした長さ（共有メモリでなければ0）
+	*/
+	unsigned int magic;
+	unsigned long shared;
+
+	/*
+		clist_set_shrink_policy()で使う
+		shrink_period:何ノード書き込むごとにpull待ちのノード数を見直すか（0なら縮めない）
+	*/
+	int min_node, shrink_period;
+
+	/* epollの通知の閾値（clist_set_watermark()でしか書かない） */
+	int rd_mark, wr_mark;
+
+	/*
+		INDEXモードで使う（clist_set_mode()で決める）
+		index_shift:log2(nr_composed)　index_mask:nr_node * nr_composed - 1
+		オブジェクトの通し番号objは、ノードがobj >> index_shift、全ノードを並べた中の位置がobj & index_maskになる
+	*/
+	int index_shift;
+	unsigned long long index_mask;
+
+	long long flush_ns;	/* w_currを開いてからこの時間（ナノ秒）が経ったら封をする（clist_set_flush_deadline() 0なら封をしない） */
 
-	struct clist_node *nodes;
+	/*
+		ここから生産者だけが書く（MPSCモードでは生産者同士で共有する）
+		w_seq:書き込みが完了したノードの累計
+		w_curr:書き込み中のclist_node（オフセット）
+		r_seq_cache:最後に読んだr_seq（満杯に見えた時だけr_seqを読み直す SPSCモードでだけ使う）
+	*/
+	unsigned long long w_seq __attribute__((aligned(CLIST_CACHELINE_SIZE)));
+	long w_curr;
+	unsigned long long w_claim;	/* MPSCモードで生産者が確保したオブジェクトの累計 */
+	unsigned long long r_seq_cache;
+	unsigned long long w_obj;	/* INDEXモードで書き込んだオブジェクトの累計（w_seqは完成したノードの累計のまま） */
+	unsigned long long w_partial;	/* 一杯になる前に封をした（fill < node_lenの）ノードの累計 */
+	long long w_open;	/* w_currに最初に書き込んだ時刻（flush_nsがある時だけ記録する 空なら0） */
+	unsigned long long w_commit;	/* flush_nsがある時に消費者に見せるw_currの状態（CLIST_COMMIT_* 消費者が封をする時だけCASで書く） */
 
 	/*
-		w_curr:書き込み中のclist_nodeのアドレス
-		r_curr:読み込み中のclist_nodeのアドレス
+		shrink_count/shrink_peak:今の周期で書き込んだノード数と、pull待ちのノード数の最大値
+		spare:縮めた時に外したノード（next_nodeでつながっていて、データ領域のページは返却済み 無ければ0）
 	*/
-	struct clist_node *w_curr, *r_curr;
+	int shrink_count, shrink_peak;
+	long spare;
+	int nr_spare;
+
+	/*
+		ここから消費者だけが書く
+		r_seq:読み込みが完了したノードの累計（OVERWRITEモードでは生産者もCASで進める）
+		r_curr:読み込み中のclist_node（オフセット）
+		w_seq_cache:最後に読んだw_seq（空に見えた時だけw_seqを読み直す）
+		pull待ちのnodeの数はw_seq - r_seqで求める
+	*/
+	unsigned long long r_seq __attribute__((aligned(CLIST_CACHELINE_SIZE)));
+	unsigned long long r_cseq;	/* 消費者が読んでいるノードの通し番号（生産者に取り返されていなければr_seqと等しい） */
+	int r_pos;		/* r_currの中で読み終わったバイト数 */
+	long r_curr;
+	unsigned long long w_seq_cache;
+	unsigned long long r_obj;	/* INDEXモードで読んだオブジェクトの累計（r_seqは読み切ったノードの累計のまま） */
+
+	/*
+		r_partial:読み切ったノードのうちfill < node_lenだったものの累計
+		w_partial_cache:w_seq_cacheと一緒に読んだw_partial（r_partialと同じなら、読めるノードは全部一杯なのでノード単位でまとめて読める）
+	*/
+	unsigned long long r_partial, w_partial_cache;
+	unsigned long long r_sealed;	/* 消費者がflush_nsの期限切れで封をしたノードの累計（w_partialには数えられない） */
+	long long r_open;	/* clist_pull_wait()が寝る時間を決めた時に読んだw_open */
+	int r_fd_pos;	/* clist_pull_to_fd()でr_currの先頭のオブジェクトを途中まで書いたバイト数 */
+
+	/*
+		ここから通知用（寝ているスレッドやeventfdがある時と、満杯/空をまたいだ時にしか書かない）
+		stateはHOT/COLDが変わるたびにCASで書くので、毎回読むだけの上のキャッシュラインには置かない
+		clist_pull_wait()/clist_push_wait()で寝るためのfutex
+		r_futex:ノードが完成するたびに増える w_futex:ノードが空くたびに増える（寝ているスレッドがいる時だけ）
+	*/
+	int state __attribute__((aligned(CLIST_CACHELINE_SIZE)));	/* CLIST_STATE_COLD:循環リストに対しての入出力禁止 CLIST_STATE_HOT:循環リストに対しての入出力可能*/
+	int r_futex;
+	int w_futex;
+	int r_waiters, w_waiters;	/* futexで寝ているスレッドの数 */
+
+	/*
+		epollで待つためのeventfd（作っていなければ-1）
+		rd_fd:pull待ちのノード数がrd_mark以上になったら通知 wr_fd:wr_mark以下になったら通知
+		rd_armed/wr_armed:通知が有効なら1（通知すると0になり、反対側をまたぐと1に戻る）
+	*/
+	int rd_fd, wr_fd;
+	int rd_armed, wr_armed;
+
+	long long lost;	/* OVERWRITEモードで上書きされて読まれなかったオブジェクトの累計 */
+
+	struct clist_wstats wstats;
+	struct clist_rstats rstats;
+
+	unsigned long long lat_hist[CLIST_LAT_NR_BUCKETS];	/* LATENCYモードでノードが循環リストにいた時間（消費者だけが書く） */
+};
+
+/*
+	pull待ちのnodeの数を返す関数
+	r_seqを先に読むので、並行にpush/pullされていても負の値にはならない
+*/
+static inline int clist_wlen(const struct clist_controller *clist_ctl)
+{
+	unsigned long long r_seq;
+
+	r_seq = clist_load_acquire(&clist_ctl->r_seq);
+
+	return (int)(clist_load_acquire(&clist_ctl->w_seq) - r_seq);
+}
+
+/* CPUごとに循環リストを持つ管理用構造体（clist_percpu.c） */
+struct clist_percpu{
+	int nr_cpu, object_size;
+	struct clist_controller **shards;	/* CPU番号で引く循環リスト */
 };
 
 /* プロトタイプ宣言 */
@@ -45,6 +283,20 @@ int clist_pushable_objects(const struct clist_controller *clist_ctl, int *n_firs
 /* データ構造のalloc/free */
 struct clist_controller *clist_alloc(int nr_node, int nr_composed, int object_size);
 void clist_free(struct clist_controller *clist_ctl);
+#ifndef __KERNEL__
+/* 別のプロセスと共有する循環リスト（POSIX共有メモリに置く） */
+struct clist_controller *clist_alloc_shared(const char *name, int nr_node, int nr_composed, int object_size);
+struct clist_controller *clist_attach_shared(const char *name);
+#endif
+int clist_set_mode(struct clist_controller *clist_ctl, int mode);
+unsigned long long clist_lost_objects(const struct clist_controller *clist_ctl);
+int clist_set_growth_policy(struct clist_controller *clist_ctl, int max_nodes);
+int clist_set_shrink_policy(struct clist_controller *clist_ctl, int min_nodes, int period);
+int clist_get_latency_histogram(const struct clist_controller *clist_ctl, unsigned long long *counts, int nr_buckets);
+unsigned long long clist_latency_bucket_ns(int bucket);
+int clist_get_stats(const struct clist_controller *clist_ctl, struct clist_stats *stats);
+int clist_set_copy_policy(struct clist_controller *clist_ctl, int policy);
+int clist_set_flush_deadline(struct clist_controller *clist_ctl, int usec);
 
 /* 循環リストにデータを書き込む/読み込む関数 */
 
@@ -54,7 +306,44 @@ int clist_pull_one(void *data, struct clist_controller *clist_ctl);
 /* 複数オブジェクト版 */
 int clist_push_order(const void *data, int n, struct clist_controller *clist_ctl);
 int clist_pull_order(void *data, int n, struct clist_controller *clist_ctl);
+#ifndef __KERNEL__
+/* ベクタ版（複数のバッファをまとめて書き込む/複数のバッファに読み分ける struct iovecは<sys/uio.h>） */
+struct iovec;
+int clist_push_iov(struct clist_controller *clist_ctl, const struct iovec *iov, int cnt);
+int clist_pull_iov(struct clist_controller *clist_ctl, const struct iovec *iov, int cnt);
+/* ファイルディスクリプタ版（ノードから直接writev()で書き出す） */
+int clist_pull_to_fd(struct clist_controller *clist_ctl, int fd, int max_objects);
+#endif
+/* ゼロコピー版（ノードの中に直接書き込む/ノードの中を直接読む） */
+void *clist_push_reserve(struct clist_controller *clist_ctl, int n, int *count);
+int clist_push_commit(struct clist_controller *clist_ctl, int n);
+int clist_pull_peek(struct clist_controller *clist_ctl, const void **ptr, int *count);
+int clist_pull_release(struct clist_controller *clist_ctl, int n);
+/* 書き込み中のノードに封をして、一杯になる前に読めるようにする */
+int clist_flush(struct clist_controller *clist_ctl);
+/* 可変長レコード版（VARLENモード） */
+int clist_push_record(const void *data, int len, struct clist_controller *clist_ctl);
+int clist_pull_record(void *buf, int size, struct clist_controller *clist_ctl);
+int clist_pull_records(void *buf, int size, int *lens, int max_records, struct clist_controller *clist_ctl);
+#ifndef __KERNEL__
+/* ブロッキング版（pull/pushできるようになるまでfutexで寝る） */
+int clist_pull_wait(void *data, int n, int timeout_ms, struct clist_controller *clist_ctl);
+int clist_push_wait(const void *data, int n, int timeout_ms, struct clist_controller *clist_ctl);
+/* epoll連携（pull待ちのノード数がwatermarkをまたいだらeventfdに通知する） */
+int clist_set_watermark(struct clist_controller *clist_ctl, int low, int high);
+int clist_get_readable_fd(struct clist_controller *clist_ctl);
+int clist_get_writable_fd(struct clist_controller *clist_ctl);
+#endif
 
 /* 最後にデータを読みきる関数 */
 int clist_set_end(struct clist_controller *clist_ctl, int *n_first, int *n_burst);
 int clist_pull_end(void *data, struct clist_controller *clist_ctl);
+
+#ifndef __KERNEL__
+/* CPUごとの循環リスト（pushは呼び出し元のCPUへ、pullは全CPUからまとめて） */
+struct clist_percpu *clist_percpu_alloc(int nr_node, int nr_composed, int object_size);
+void clist_percpu_free(struct clist_percpu *pcl);
+int clist_percpu_push_one(const void *data, struct clist_percpu *pcl);
+int clist_percpu_push_order(const void *data, int n, struct clist_percpu *pcl);
+int clist_percpu_drain(void *data, int n, unsigned long long (*key)(const void *object), struct clist_percpu *pcl);
+#endif
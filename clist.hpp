@@ -0,0 +1,436 @@
+#ifndef CLIST_HPP
+#define CLIST_HPP
+
+/*
+	clist_push_order()/clist_pull_order()と同じ動きをする循環リストのC++テンプレート版（ヘッダだけで使える）
+	@T オブジェクトの型（memcpyでコピーできる型）
+	@NrComposed 循環リスト１段に含まれるオブジェクトの数
+	@NrNode 循環リストの段数
+
+	オブジェクトのサイズとノードの大きさがコンパイル時に決まるので、
+	objs_to_byte()/byte_to_objs()の掛け算・割り算は消え、コピーはTの固定長のコピーになる
+	NrNodeが2の累乗ならノードの番号はマスクで求める
+
+	C版と同じく生産者1つ、消費者1つならロック無しで並行に使える
+	書き込みが完了したノードしか読まない 最後はset_end()の後にpull_end()で書き込み中のノードを読む
+	満杯になったpushは0を返してCOLDになり、空きができるまで-EAGAINを返す
+
+	例：clist<struct event, 64, 8> *cl = new clist<struct event, 64, 8>;
+	（ノードの領域をオブジェクトの中に持つので、大きいものはスタックに置かないこと）
+*/
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>	/* posix_memalign */
+#include <new>	/* std::bad_alloc */
+#include <algorithm>	/* std::copy_n */
+#include <type_traits>
+
+template<typename T, int NrComposed, int NrNode>
+class clist{
+	static_assert(NrComposed >= 1, "NrComposed must be at least 1");
+	static_assert(NrNode >= 2, "NrNode must be at least 2");
+	static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+
+public:
+	static constexpr int nr_composed = NrComposed;
+	static constexpr int nr_node = NrNode;
+	static constexpr int object_size = (int)sizeof(T);
+	static constexpr int node_len = (int)sizeof(T) * NrComposed;
+	static constexpr int cacheline_size = 64;
+
+	/* C版のCLIST_STATE_*と同じ値 */
+	static constexpr int state_cold = 0;
+	static constexpr int state_hot = 1;
+	static constexpr int state_end = 2;
+
+	clist() : w_seq(0), w_pos(0), r_cache(0), r_seq(0), r_pos(0), w_cache(0), state(state_hot)
+	{
+	}
+
+	clist(const clist &) = delete;
+	clist &operator=(const clist &) = delete;
+
+	/* C++17より前のnewでもキャッシュラインに揃える（clist_alloc()と同じくposix_memalign()で確保） */
+	static void *operator new(std::size_t size)
+	{
+		void *p;
+
+		if(posix_memalign(&p, cacheline_size, size) != 0){
+			throw std::bad_alloc();
+		}
+
+		return p;
+	}
+
+	static void operator delete(void *p) noexcept
+	{
+		free(p);
+	}
+
+	bool is_hot() const { return state.load(std::memory_order_acquire) == state_hot; }
+	bool is_cold() const { return state.load(std::memory_order_acquire) == state_cold; }
+	bool is_end() const { return state.load(std::memory_order_acquire) == state_end; }
+
+	/*
+		read可能なオブジェクトの個数を返す関数（消費者側から呼び出すこと）
+		@n_first r_currに残っているオブジェクトの個数を格納するアドレス（任意）
+		@n_burst ノード丸ごと読める数（任意）
+	*/
+	int pullable_objects(int *n_first = nullptr, int *n_burst = nullptr)
+	{
+		int ready, first, burst;
+
+		ready = ready_nodes(0);
+
+		if(ready == 0){
+			first = 0;
+			burst = 0;
+		}
+		else{
+			first = NrComposed - r_pos;
+			burst = ready - 1;
+		}
+
+		if(n_first){
+			*n_first = first;
+		}
+		if(n_burst){
+			*n_burst = burst;
+		}
+
+		return first + burst * NrComposed;
+	}
+
+	/*
+		write可能なオブジェクトの個数を返す関数（生産者側から呼び出すこと）
+		@n_first w_currにあと書き込めるオブジェクトの個数を格納するアドレス（任意）
+		@n_burst ノード丸ごと書き込める数（任意）
+	*/
+	int pushable_objects(int *n_first = nullptr, int *n_burst = nullptr)
+	{
+		int free, first, burst;
+
+		free = free_nodes(NrNode);
+
+		if(free == 0){
+			first = 0;
+			burst = 0;
+		}
+		else{
+			first = NrComposed - w_pos;
+			burst = free - 1;
+		}
+
+		if(n_first){
+			*n_first = first;
+		}
+		if(n_burst){
+			*n_burst = burst;
+		}
+
+		return first + burst * NrComposed;
+	}
+
+	/*
+		循環リストに1オブジェクトだけデータを追加する関数
+		return 成功：1　失敗：マイナスのエラーコード、もしくは0
+	*/
+	int push_one(const T &obj)
+	{
+		int free = free_nodes(1);
+
+		if(!push_permitted(free)){
+			return -EAGAIN;	/* push禁止だったらエラー */
+		}
+
+		if(free == 0){
+			set_cold();
+			return 0;
+		}
+
+		nodes[node_index(w_seq.load(std::memory_order_relaxed))][w_pos] = obj;
+		w_advance(1);
+
+		return 1;
+	}
+
+	/*
+		循環リストから1オブジェクトだけデータを読む関数
+		return 成功：1　読めるデータが無い：0
+	*/
+	int pull_one(T &obj)
+	{
+		if(ready_nodes(1) == 0){
+			return 0;
+		}
+
+		obj = nodes[node_index(r_seq.load(std::memory_order_relaxed))][r_pos];
+		r_advance(1);
+		set_hot();
+
+		return 1;
+	}
+
+	/*
+		循環リストにデータを追加する関数
+		@data データが入っているアドレス
+		@n オブジェクトの個数
+		return 成功：追加したオブジェクトの個数　失敗：マイナスのエラーコード
+
+		入りきらない分は書き込まない（戻り値がnより小さければ、残りはユーザ側で再送する）
+	*/
+	int push_order(const T *data, int n)
+	{
+		int scope, take, done, piece;
+
+		scope = free_objects(n);
+
+		if(!push_permitted(scope)){
+			return -EAGAIN;	/* push禁止だったらエラー */
+		}
+
+		if(scope == 0){
+			set_cold();	/* push禁止に設定する */
+			return 0;
+		}
+
+		take = n < scope ? n : scope;
+
+		for(done = 0; done < take; done += piece){
+			T *dest = &nodes[node_index(w_seq.load(std::memory_order_relaxed))][w_pos];
+
+			piece = NrComposed - w_pos;
+
+			if(piece <= take - done){
+				if(piece == NrComposed){
+					std::copy_n(data + done, NrComposed, dest);	/* ノード丸ごと（固定長） */
+				}
+				else{
+					std::copy_n(data + done, piece, dest);
+				}
+			}
+			else{
+				piece = take - done;
+				std::copy_n(data + done, piece, dest);
+			}
+
+			w_advance(piece);
+		}
+
+		return take;
+	}
+
+	/*
+		循環リストからnだけデータを読む関数
+		@data データを格納するアドレス
+		@n 読み込む最大オブジェクト数
+		return dataに格納したオブジェクトの個数
+
+		※書き込みが完了したノードしか読まない
+	*/
+	int pull_order(T *data, int n)
+	{
+		int scope, take, done, piece;
+
+		scope = ready_objects(n);
+		take = n < scope ? n : scope;
+
+		for(done = 0; done < take; done += piece){
+			const T *src = &nodes[node_index(r_seq.load(std::memory_order_relaxed))][r_pos];
+
+			piece = NrComposed - r_pos;
+
+			if(piece <= take - done){
+				if(piece == NrComposed){
+					std::copy_n(src, NrComposed, data + done);	/* ノード丸ごと（固定長） */
+				}
+				else{
+					std::copy_n(src, piece, data + done);
+				}
+			}
+			else{
+				piece = take - done;
+				std::copy_n(src, piece, data + done);
+			}
+
+			r_advance(piece);
+		}
+
+		set_hot();	/* COLDだったらpush許可に設定する */
+
+		return take;
+	}
+
+	/*
+		END状態にして、書き込み中のノードに入っているオブジェクトの個数を返す関数
+		@n_first/@n_burst pullable_objects()と同じ（任意）
+
+		※生産者が止まってから呼び出すこと
+	*/
+	int set_end(int *n_first = nullptr, int *n_burst = nullptr)
+	{
+		state.store(state_end, std::memory_order_release);
+
+		pullable_objects(n_first, n_burst);
+
+		return w_pos;
+	}
+
+	/*
+		書き込み中のノードからデータを読む関数
+		@data データを格納するアドレス（NrComposed個入ること）
+		return 成功：dataに格納したオブジェクトの個数 失敗：マイナスのエラーコード
+
+		※set_end()の後に、完成したノードを読み切ってから呼び出すこと
+	*/
+	int pull_end(T *data)
+	{
+		int n;
+
+		if(!is_end()){
+			return -ECANCELED;
+		}
+
+		n = w_pos;
+
+		std::copy_n(nodes[node_index(w_seq.load(std::memory_order_relaxed))], n, data);
+		w_pos = 0;
+
+		return n;
+	}
+
+private:
+	static constexpr bool pow2_nodes = (NrNode & (NrNode - 1)) == 0;
+
+	/* 通し番号からノードの番号を求める関数（2の累乗ならマスク） */
+	static unsigned long long node_index(unsigned long long seq)
+	{
+		return pow2_nodes ? (seq & (unsigned long long)(NrNode - 1)) : (seq % (unsigned long long)NrNode);
+	}
+
+	/*
+		生産者側から見た空きノード数（書き込み中のノードを含む）を返す関数
+		@want これだけあれば足りるノード数 キャッシュしたr_seqで足りなければ読み直す
+	*/
+	int free_nodes(int want)
+	{
+		unsigned long long w = w_seq.load(std::memory_order_relaxed);
+		int free = NrNode - (int)(w - r_cache);
+
+		if(free < want){
+			r_cache = r_seq.load(std::memory_order_acquire);
+			free = NrNode - (int)(w - r_cache);
+		}
+
+		return free;
+	}
+
+	/* 生産者側から見たwrite可能なオブジェクトの個数（nあれば足りる） */
+	int free_objects(int n)
+	{
+		int free = free_nodes((n + w_pos + NrComposed - 1) / NrComposed);
+
+		return free == 0 ? 0 : free * NrComposed - w_pos;
+	}
+
+	/*
+		消費者側から見た完成済みのノード数を返す関数
+		@want これだけあれば足りるノード数 キャッシュしたw_seqで足りなければ読み直す（0なら必ず読み直す）
+	*/
+	int ready_nodes(int want)
+	{
+		unsigned long long r = r_seq.load(std::memory_order_relaxed);
+		int ready = (int)(w_cache - r);
+
+		if(want == 0 || ready < want){
+			w_cache = w_seq.load(std::memory_order_acquire);
+			ready = (int)(w_cache - r);
+		}
+
+		return ready;
+	}
+
+	/* 消費者側から見たread可能なオブジェクトの個数（nあれば足りる） */
+	int ready_objects(int n)
+	{
+		int ready = ready_nodes((n + r_pos + NrComposed - 1) / NrComposed);
+
+		return ready == 0 ? 0 : ready * NrComposed - r_pos;
+	}
+
+	/* w_currの書き込み位置を進め、ノードが一杯になったら消費者に公開する */
+	void w_advance(int n)
+	{
+		w_pos += n;
+
+		if(w_pos == NrComposed){
+			w_pos = 0;
+			w_seq.store(w_seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+	}
+
+	/* r_currの読み出し位置を進め、ノードを読み切ったら生産者に返す */
+	void r_advance(int n)
+	{
+		r_pos += n;
+
+		if(r_pos == NrComposed){
+			r_pos = 0;
+			r_seq.store(r_seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+	}
+
+	/* COLDでも空きができていればHOTに戻してpushを許す（C版のclist_push_permitted()と同じ） */
+	bool push_permitted(int scope)
+	{
+		int cold = state_cold;
+
+		if(state.load(std::memory_order_acquire) != state_cold){
+			return true;
+		}
+
+		if(scope > 0){
+			state.compare_exchange_strong(cold, state_hot);
+			return true;
+		}
+
+		return false;
+	}
+
+	/* END状態を上書きしないようにHOTの時だけCOLDにする */
+	void set_cold()
+	{
+		int hot = state_hot;
+
+		state.compare_exchange_strong(hot, state_cold);
+	}
+
+	void set_hot()
+	{
+		int cold = state_cold;
+
+		if(state.load(std::memory_order_relaxed) == state_cold){
+			state.compare_exchange_strong(cold, state_hot);
+		}
+	}
+
+	/*
+		生産者だけが書くもの、消費者だけが書くもの、ノードの領域をそれぞれ別のキャッシュラインに置く
+		w_seq/r_seq:完成したノード/読み終わったノードの累計　w_pos/r_pos:書き込み中/読み込み中のノードの中の位置
+		r_cache/w_cache:相手側の累計を最後に読んだ値（足りない時だけ読み直す）
+	*/
+	alignas(cacheline_size) std::atomic<unsigned long long> w_seq;
+	int w_pos;
+	unsigned long long r_cache;
+
+	alignas(cacheline_size) std::atomic<unsigned long long> r_seq;
+	int r_pos;
+	unsigned long long w_cache;
+
+	alignas(cacheline_size) std::atomic<int> state;
+
+	alignas(cacheline_size) T nodes[NrNode][NrComposed];
+};
+
+#endif	/* CLIST_HPP */
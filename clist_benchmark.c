@@ -1,256 +1,839 @@
+#define _GNU_SOURCE	/* pthread_setaffinity_np() */
 #include <stdio.h>
 #include <pthread.h>
 #include <stdlib.h>
-#include <string.h>	/* strerror() */
-#include <unistd.h>
-#include <signal.h>
-#include <time.h>	/* rand(), srand() */
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>	/* getopt(), sysconf() */
+#include <sched.h>	/* sched_yield(), CPU_SET() */
+#include <time.h>	/* clock_gettime() */
+#include <sys/uio.h>	/* struct iovec */
 #include "clist.h"
+#include "clist_trace.h"
 
-#define SEND_FREQUENCY		2	/* send_workerが送る時間（秒） */
-#define SEND_GRAIN_SIZE		5	/* send_workerが送るデータ単位量（オブジェクトの数） */
+/*
+	循環リストのスループットとレイテンシを測るベンチマーク
+	生産者スレッドと消費者スレッドを全速で回し、結果をJSONで標準出力に書く
+
+	使い方：clist_benchmark [-n 段数] [-c 1段のオブジェクト数] [-s オブジェクトのサイズ]
+			[-b pushする数] [-B pullする数] [-a one|order|iov] [-p 生産者数] [-C 消費者数]
+			[-N 生産者1つあたりのオブジェクト数] [-l レイテンシを測る間隔] [-q clist|mutex|all] [-M auto|memcpy|stream] [-I] [-F 封をする期限] [-A] [-R] [-T トレースの出力先]
+
+	-A を付けるとスレッドをCPUに順番に固定する 生産者が2つ以上ならclistはMPSCモードで動かす
+	-R を付けるとclistをLATENCYモードにして、ノードが循環リストにいた時間の分布も出力する
+	-I を付けるとclistをINDEXモード（通し番号とマスクで位置を求める）にする 段数と1段の数は2の累乗にすること
+	-M でclistのコピーの方法（clist_set_copy_policy()）を選ぶ memcpyと比べれば固定長コピーとnon-temporalストアの効果が分かる
+	-F でclistのw_currを開いてから封をするまでの期限（マイクロ秒 clist_set_flush_deadline()）を決める -lと組み合わせると遅延の上限が分かる
+	-T を付けると終わった後にclist_trace_dump()の結果をファイルに書く（make traceでビルドした時だけ記録される）
+	clistの結果にはclist_get_stats()の統計も付ける
+	clistは消費者1つの設計なので、消費者が2つ以上の時はmutexで1つずつpullさせる
+	-q allなら同じ条件でmutex+配列のキューも測り、比較できるように続けて出力する
+*/
 
-#define RECV_FREQUENCY_STATIC	2	/* recieve_workerが受信する静的時間（秒） */
-#define RECV_FREQUENCY_DYNAMIC	4	/* recieve_workerが受信する動的時間（秒） */
+#define BENCH_NR_NODE		64
+#define BENCH_NR_COMPOSED	64
+#define BENCH_OBJECT_SIZE	32
+#define BENCH_PUSH_BATCH	16
+#define BENCH_PULL_BATCH	64
+#define BENCH_NR_OBJECTS	2000000ULL
+#define BENCH_LAT_STRIDE	16	/* 何回に1回レイテンシを測るか（毎回測るとclock_gettime()の分だけ遅くなる） */
+#define BENCH_LAT_SAMPLES	(1 << 20)	/* スレッドごとに覚えておくレイテンシの数（超えたら古いものから上書き） */
+
+#define BENCH_API_ORDER	0	/* clist_push_order()/clist_pull_order() */
+#define BENCH_API_ONE	1	/* clist_push_one()/clist_pull_one() */
+#define BENCH_API_IOV	2	/* clist_push_iov()/clist_pull_iov()（バッファを前半と後半の2つに分けて渡す） */
+
+struct bench;
+
+/* 測る対象のキュー */
+struct bench_queue{
+	const char *name;
+	int (*setup)(struct bench *b);
+	void (*teardown)(struct bench *b);
+	int (*push)(struct bench *b, const void *data, int n);
+	int (*pull)(struct bench *b, void *data, int n);
+	int (*drain)(struct bench *b, void *data, int n);	/* 生産者が全員終わった後に読み残しを読む（任意） */
+	void (*report)(struct bench *b);	/* キュー固有の結果をJSONのメンバとして書く（任意） */
+	unsigned long long (*cold_transitions)(struct bench *b);	/* 満杯でpush禁止（COLD）になった回数（任意 無ければ0） */
+};
 
-#define RECV_FREQUENCY()		(rand() % RECV_FREQUENCY_DYNAMIC) + RECV_FREQUENCY_STATIC;
+/* 比較用のmutex+配列のキュー */
+struct mutex_queue{
+	pthread_mutex_t lock;
+	char *buf;
+	size_t cap, head, count;	/* オブジェクト単位 */
+};
 
-#define RECV_GRAIN_SIZE		5	/* recieve_workerが受信するデータ単位量（オブジェクトの数） */
+/* スレッドごとの計測値 */
+struct bench_thread{
+	int id;
+	pthread_t tid;
+	struct bench *b;
 
-static int death_flag = 0;
+	unsigned long long objects, calls;
+	unsigned long long full_events;	/* 満杯で全部はpushできなかった回数（短く書けた時も-EAGAINで断られた時も1回） */
+	unsigned long long bad_order;
 
-unsigned int count;
+	unsigned int *lat;	/* ナノ秒 */
+	size_t nr_lat;
+	unsigned long long lat_tick;
+};
 
-struct sample_object{
-	unsigned long long id_no;
-	char padding[24];	/* 合計で32バイトになるように */
+struct bench{
+	/* パラメータ */
+	int nr_node, nr_composed, object_size;
+	int push_batch, pull_batch, api;
+	int nr_producer, nr_consumer, pin;
+	int residence;	/* -R */
+	int copy_policy;	/* -M */
+	int index;	/* -I */
+	int flush_us;	/* -F */
+	unsigned long long nr_objects;
+	int lat_stride;
+
+	const struct bench_queue *queue;
+	struct clist_controller *clist_ctl;
+	struct mutex_queue mq;
+	pthread_mutex_t pull_lock;	/* 消費者が2つ以上の時だけ使う */
+
+	pthread_barrier_t start;
+	int producers_done;
+
+	struct bench_thread *producers, *consumers;
+	unsigned long long *next_seq;	/* 生産者ごとに、次に届くはずの通し番号 */
 };
 
+/***********************************
+*
+*	キューごとの処理
+*
+************************************/
+
+static int bench_clist_setup(struct bench *b)
+{
+	int mode = CLIST_MODE_SPSC, ret;
+
+	if(b->nr_producer > 1 && b->api == BENCH_API_IOV){
+		return -EINVAL;	/* clist_push_iov()はSPSCモードでしか使えない */
+	}
+
+	b->clist_ctl = clist_alloc(b->nr_node, b->nr_composed, b->object_size);
+
+	if(b->clist_ctl == NULL){
+		return -ENOMEM;
+	}
+
+	if(b->nr_producer > 1){
+		mode |= CLIST_MODE_MPSC;
+	}
+	if(b->residence){
+		mode |= CLIST_MODE_LATENCY;
+	}
+	if(b->index){
+		mode |= CLIST_MODE_INDEX;
+	}
+
+	clist_set_copy_policy(b->clist_ctl, b->copy_policy);
+
+	ret = clist_set_mode(b->clist_ctl, mode);
+
+	if(ret == 0 && b->flush_us){
+		ret = clist_set_flush_deadline(b->clist_ctl, b->flush_us);	/* モードを決めてからでないと確かめられない */
+	}
+
+	return ret;
+}
+
+static void bench_clist_teardown(struct bench *b)
+{
+	clist_free(b->clist_ctl);
+}
+
+static int bench_clist_push(struct bench *b, const void *data, int n)
+{
+	struct iovec iov[2];
+
+	if(b->api == BENCH_API_ONE){
+		return clist_push_one(data, b->clist_ctl);
+	}
+
+	if(b->api == BENCH_API_IOV){
+		iov[0].iov_base = (void *)data;
+		iov[0].iov_len = (size_t)n * b->object_size / 2;
+		iov[1].iov_base = (char *)data + iov[0].iov_len;
+		iov[1].iov_len = (size_t)n * b->object_size - iov[0].iov_len;
 
-unsigned int count, spilled;
+		return clist_push_iov(b->clist_ctl, iov, 2);
+	}
+
+	return clist_push_order(data, n, b->clist_ctl);
+}
+
+static int bench_clist_pull(struct bench *b, void *data, int n)
+{
+	struct iovec iov[2];
+
+	if(b->api == BENCH_API_ONE){
+		return clist_pull_one(data, b->clist_ctl);
+	}
+
+	if(b->api == BENCH_API_IOV){
+		iov[0].iov_base = data;
+		iov[0].iov_len = (size_t)n * b->object_size / 2;
+		iov[1].iov_base = (char *)data + iov[0].iov_len;
+		iov[1].iov_len = (size_t)n * b->object_size - iov[0].iov_len;
+
+		return clist_pull_iov(b->clist_ctl, iov, 2);
+	}
+
+	return clist_pull_order(data, n, b->clist_ctl);
+}
+
+static unsigned long long bench_clist_cold_transitions(struct bench *b)
+{
+	struct clist_stats st;
+
+	if(clist_get_stats(b->clist_ctl, &st) != 0){
+		return 0;
+	}
+
+	return st.cold_transitions;
+}
+
+/*
+	書き込み中のノードに残っている分まで読む関数
+	clist_set_end()の後、完成したノードを読み切ってからclist_pull_end()で最後のノードを読む
+*/
+static int bench_clist_drain(struct bench *b, void *data, int n)
+{
+	int ret;
+
+	if(!CLIST_IS_END(b->clist_ctl)){
+		clist_set_end(b->clist_ctl, NULL, NULL);
+	}
+
+	ret = clist_pull_order(data, n, b->clist_ctl);
+
+	if(ret == 0){
+		ret = clist_pull_end(data, b->clist_ctl);
+	}
+
+	return ret < 0 ? 0 : ret;
+}
 
 /*
-	循環リストにデータをpushするスレッド
+	clist_get_stats()の統計と、LATENCYモードならノードが循環リストにいた時間の分位点を書く関数
+	分位点はバケットの下限を値とするので、実際の値より最大1/8ほど小さく出る
 */
-void *send_worker(void *p)
+static void bench_clist_report(struct bench *b)
+{
+	int i, nr;
+	unsigned long long counts[CLIST_LAT_NR_BUCKETS], total = 0, sum = 0;
+	const double q[] = { 0.5, 0.99, 0.999 };
+	const char *qname[] = { "p50", "p99", "p999" };
+	int k = 0;
+	struct clist_stats st;
+
+	printf(",\"copy\":\"%s\",\"index\":%s,\"flush_us\":%d", b->copy_policy == CLIST_COPY_MEMCPY ? "memcpy" : b->copy_policy == CLIST_COPY_STREAM ? "stream" : "auto",
+		b->index ? "true" : "false", b->flush_us);
+
+	if(clist_get_stats(b->clist_ctl, &st) == 0){
+		printf(",\"stats\":{\"pushed_objects\":%llu,\"pushed_bytes\":%llu,\"pulled_objects\":%llu,\"pulled_bytes\":%llu,"
+			"\"partial_pushes\":%llu,\"cold_transitions\":%llu,\"full_ns\":%llu,\"pull_end_calls\":%llu,\"max_wait_length\":%d}",
+			st.pushed_objects, st.pushed_bytes, st.pulled_objects, st.pulled_bytes,
+			st.partial_pushes, st.cold_transitions, st.full_ns, st.pull_end_calls, st.max_wait_length);
+	}
+
+	nr = clist_get_latency_histogram(b->clist_ctl, counts, CLIST_LAT_NR_BUCKETS);
+
+	if(nr < 0){
+		return;
+	}
+
+	for(i = 0; i < nr; i++){
+		total += counts[i];
+	}
+
+	printf(",\"residence_ns\":{\"nodes\":%llu", total);
+
+	for(i = 0; i < nr && k < 3 && total; i++){
+		sum += counts[i];
+
+		while(k < 3 && sum >= q[k] * total){
+			printf(",\"%s\":%llu", qname[k], clist_latency_bucket_ns(i));
+			k++;
+		}
+	}
+
+	printf("}");
+}
+
+static int bench_mutex_setup(struct bench *b)
+{
+	struct mutex_queue *mq = &b->mq;
+
+	mq->cap = (size_t)b->nr_node * b->nr_composed;
+	mq->head = 0;
+	mq->count = 0;
+	mq->buf = malloc(mq->cap * b->object_size);
+
+	if(mq->buf == NULL){
+		return -ENOMEM;
+	}
+
+	pthread_mutex_init(&mq->lock, NULL);
+
+	return 0;
+}
+
+static void bench_mutex_teardown(struct bench *b)
+{
+	pthread_mutex_destroy(&b->mq.lock);
+	free(b->mq.buf);
+}
+
+/*
+	mutex+配列のキューに書き込む関数 入りきらない分は書かずに個数を返す（clist_push_order()と同じ扱い）
+*/
+static int bench_mutex_push(struct bench *b, const void *data, int n)
+{
+	size_t tail, first;
+	struct mutex_queue *mq = &b->mq;
+
+	pthread_mutex_lock(&mq->lock);
+
+	if((size_t)n > mq->cap - mq->count){
+		n = (int)(mq->cap - mq->count);
+	}
+
+	tail = (mq->head + mq->count) % mq->cap;
+	first = mq->cap - tail < (size_t)n ? mq->cap - tail : (size_t)n;
+
+	memcpy(mq->buf + tail * b->object_size, data, first * b->object_size);
+	memcpy(mq->buf, (const char *)data + first * b->object_size, (n - first) * b->object_size);
+	mq->count += n;
+
+	pthread_mutex_unlock(&mq->lock);
+
+	return n;
+}
+
+static int bench_mutex_pull(struct bench *b, void *data, int n)
+{
+	size_t first;
+	struct mutex_queue *mq = &b->mq;
+
+	pthread_mutex_lock(&mq->lock);
+
+	if((size_t)n > mq->count){
+		n = (int)mq->count;
+	}
+
+	first = mq->cap - mq->head < (size_t)n ? mq->cap - mq->head : (size_t)n;
+
+	memcpy(data, mq->buf + mq->head * b->object_size, first * b->object_size);
+	memcpy((char *)data + first * b->object_size, mq->buf, (n - first) * b->object_size);
+	mq->head = (mq->head + n) % mq->cap;
+	mq->count -= n;
+
+	pthread_mutex_unlock(&mq->lock);
+
+	return n;
+}
+
+static const struct bench_queue bench_queues[] = {
+	{ "clist", bench_clist_setup, bench_clist_teardown, bench_clist_push, bench_clist_pull, bench_clist_drain, bench_clist_report, bench_clist_cold_transitions },
+	{ "mutex", bench_mutex_setup, bench_mutex_teardown, bench_mutex_push, bench_mutex_pull, NULL, NULL, NULL },
+};
+
+/***********************************
+*
+*	計測
+*
+************************************/
+
+static inline unsigned long long bench_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bench_record_latency(struct bench_thread *t, unsigned long long ns)
+{
+	t->lat[t->nr_lat % BENCH_LAT_SAMPLES] = ns > 0xffffffffULL ? 0xffffffffU : (unsigned int)ns;
+	t->nr_lat++;
+}
+
+/*
+	スレッドをCPUに固定する関数（-A）
+	生産者、消費者の順に0番のCPUから割り当てる
+*/
+static void bench_pin(int slot)
+{
+	long nr_cpu;
+	cpu_set_t set;
+
+	nr_cpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if(nr_cpu < 1){
+		nr_cpu = 1;
+	}
+
+	CPU_ZERO(&set);
+	CPU_SET(slot % nr_cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/*
+	受け取ったオブジェクトの順番を確かめる関数
+	先頭8バイトは（生産者の番号 << 48 | 通し番号）で、生産者ごとに1ずつ増えていれば正しい
+*/
+static void bench_check(struct bench_thread *t, const char *buf, int n)
 {
 	int i;
-	int ret = 0;
-	struct clist_controller *clist_ctl;
-	struct sample_object sobj[SEND_GRAIN_SIZE];
+	unsigned long long tag, producer, seq;
+	struct bench *b = t->b;
 
-	clist_ctl = (struct clist_controller *)p;
+	for(i = 0; i < n; i++){
+		memcpy(&tag, buf + (size_t)i * b->object_size, sizeof(tag));
 
-	while(1){
-		if(death_flag == 1){
-			break;
+		producer = tag >> 48;
+		seq = tag & ((1ULL << 48) - 1);
+
+		if(producer >= (unsigned long long)b->nr_producer || seq != b->next_seq[producer]){
+			t->bad_order++;
+		}
+		else{
+			b->next_seq[producer]++;
 		}
+	}
+
+	t->objects += n;
+}
+
+/*
+	データをpushし続けるスレッド
+*/
+static void *bench_producer(void *p)
+{
+	int i, n, ret;
+	unsigned long long sent = 0, t0 = 0, tag;
+	char *buf;
+	struct bench_thread *t = (struct bench_thread *)p;
+	struct bench *b = t->b;
+
+	if(b->pin){
+		bench_pin(t->id);
+	}
+
+	buf = calloc(b->push_batch, b->object_size);
 
-		sleep(SEND_FREQUENCY);
+	pthread_barrier_wait(&b->start);
 
-		for(i = 0; i < SEND_GRAIN_SIZE; i++){
-			sobj[i].id_no = count;
-			strcpy(sobj[i].padding, "");
+	while(sent < b->nr_objects){
+		n = b->api == BENCH_API_ONE ? 1 : b->push_batch;
 
-			count++;
+		if(b->nr_objects - sent < (unsigned long long)n){
+			n = (int)(b->nr_objects - sent);
 		}
 
-#if 0
-		for(i = 0; i < SEND_GRAIN_SIZE; i++){
-			if(clist_push_one((void *)&sobj[i], clist_ctl) < 0){
-				spileed
-			}
-			else{
-				ret++;
-			}
+		for(i = 0; i < n; i++){
+			tag = ((unsigned long long)t->id << 48) | (sent + i);
+			memcpy(buf + (size_t)i * b->object_size, &tag, sizeof(tag));
+		}
+
+		if(t->lat_tick % b->lat_stride == 0){
+			t0 = bench_now_ns();
+		}
+
+		ret = b->queue->push(b, buf, n);
+		t->calls++;
+
+		if(ret > 0 && t->lat_tick++ % b->lat_stride == 0){
+			bench_record_latency(t, bench_now_ns() - t0);
+		}
+
+		if(ret < n && (ret >= 0 || ret == -EAGAIN)){
+			t->full_events++;	/* 満杯を短い書き込みで知らせるキューとCOLDで断るキューを同じに数える */
 		}
-#endif
-		ret = clist_push_order((void *)sobj, SEND_GRAIN_SIZE, clist_ctl);
 
 		if(ret < 0){
-			/* clist側からエラーが帰ってきている */
-			printf("%s\n", strerror(-ret));
-			spilled++;
+			sched_yield();
+			continue;
+		}
 
-			sleep(15);
-			ret = clist_push_order((void *)sobj, SEND_GRAIN_SIZE, clist_ctl);	/* リトライ */
+		if(ret == 0){
+			sched_yield();
 		}
-		else if(ret != SEND_GRAIN_SIZE){
-			struct sample_object *s;
 
-			/* clist_push()に失敗したデータを表示 */
-			for(i = 0; i < SEND_GRAIN_SIZE - ret; i++){
+		sent += ret;
+	}
+
+	t->objects = sent;
+	free(buf);
 
-				s = &sobj[ret + i];
+	return NULL;
+}
 
-#ifdef DEBUG
-				printf("\t*** sobj[%d].id_no:%llu\n", i, s->id_no);
-#endif
+/*
+	データをpullし続けるスレッド
+	生産者が全員終わって、何も読めなくなったら終わる
+*/
+static void *bench_consumer(void *p)
+{
+	int n, want;
+	unsigned long long t0 = 0;
+	char *buf;
+	struct bench_thread *t = (struct bench_thread *)p;
+	struct bench *b = t->b;
+
+	if(b->pin){
+		bench_pin(b->nr_producer + t->id);
+	}
+
+	buf = calloc(b->pull_batch, b->object_size);
+	want = b->api == BENCH_API_ONE ? 1 : b->pull_batch;
+
+	pthread_barrier_wait(&b->start);
+
+	while(1){
+		if(b->nr_consumer > 1){
+			pthread_mutex_lock(&b->pull_lock);
+		}
+
+		if(t->lat_tick % b->lat_stride == 0){
+			t0 = bench_now_ns();
+		}
+
+		n = b->queue->pull(b, buf, want);
+		t->calls++;
+
+		if(n > 0){
+			if(t->lat_tick++ % b->lat_stride == 0){
+				bench_record_latency(t, bench_now_ns() - t0);
 			}
 
-			sleep(15);
-			clist_push_order((void *)&sobj[ret], (SEND_GRAIN_SIZE - ret), clist_ctl);
+			bench_check(t, buf, n);
+		}
+
+		if(b->nr_consumer > 1){
+			pthread_mutex_unlock(&b->pull_lock);
+		}
+
+		if(n > 0){
+			continue;
 		}
-		ret = 0;
+
+		if(__atomic_load_n(&b->producers_done, __ATOMIC_ACQUIRE)){
+			break;
+		}
+
+		sched_yield();
 	}
 
-	death_flag = 2;
+	free(buf);
 
 	return NULL;
 }
 
+static int bench_cmp_uint(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+
+	return x < y ? -1 : x > y;
+}
+
 /*
-	循環リストからデータを回収するスレッド
+	スレッド群のレイテンシをまとめて、p50/p99/p999をJSONで書く関数
 */
-void *recieve_worker(void *p)
+static void bench_print_latency(const char *name, struct bench_thread *threads, int nr)
 {
-	int sleep_time, i;
-	struct sample_object *sobj;
-	struct clist_controller *clist_ctl;
+	int i;
+	size_t n = 0, k;
+	unsigned int *all;
 
-	sobj = calloc(RECV_GRAIN_SIZE, sizeof(struct sample_object));
+	for(i = 0; i < nr; i++){
+		n += threads[i].nr_lat < BENCH_LAT_SAMPLES ? threads[i].nr_lat : BENCH_LAT_SAMPLES;
+	}
 
-	srand(time(NULL));
+	printf("\"%s\":{\"samples\":%zu", name, n);
 
-	clist_ctl = (struct clist_controller *)p;
+	all = n ? malloc(n * sizeof(*all)) : NULL;
 
-	while(1){
-		if(death_flag == 2){
-			break;
+	if(all){
+		for(i = 0, k = 0; i < nr; i++){
+			size_t m = threads[i].nr_lat < BENCH_LAT_SAMPLES ? threads[i].nr_lat : BENCH_LAT_SAMPLES;
+
+			memcpy(all + k, threads[i].lat, m * sizeof(*all));
+			k += m;
 		}
 
-		sleep_time = RECV_FREQUENCY();
-#ifdef DEBUG
-		printf("sleep_time:%d\n", sleep_time);
-#endif
-		sleep(sleep_time);
+		qsort(all, n, sizeof(*all), bench_cmp_uint);
 
-		if(clist_wlen(clist_ctl) > 0){
+		printf(",\"p50\":%u,\"p99\":%u,\"p999\":%u,\"max\":%u",
+			all[n * 50 / 100], all[n * 99 / 100], all[n * 999 / 1000], all[n - 1]);
+		free(all);
+	}
 
-			int pick_len = 0;
+	printf("}");
+}
 
-			pick_len = clist_pull_order((void *)sobj, RECV_GRAIN_SIZE, clist_ctl);
+static struct bench_thread *bench_threads(struct bench *b, int nr)
+{
+	int i;
+	struct bench_thread *threads;
 
-			//for(i = 0; i < RECV_GRAIN_SIZE; i++){
-			//	pick_len += clist_pull_one((void *)&sobj[i], clist_ctl);
-			//}
+	threads = calloc(nr, sizeof(*threads));
 
-#ifdef DEBUG
-			printf("recieve_data_worker pick_len:%d\n",pick_len);
-#endif
+	for(i = 0; threads && i < nr; i++){
+		threads[i].id = i;
+		threads[i].b = b;
+		threads[i].lat = malloc(BENCH_LAT_SAMPLES * sizeof(unsigned int));
 
-#ifdef DEBUG
-			for(i = 0; i < pick_len; i++){
-				printf("\tsobj[%d].id_no:%llu\n", i, sobj[i].id_no);
-			}
-			puts("\t*****");
-#endif
+		if(threads[i].lat == NULL){
+			return NULL;
 		}
 	}
 
-	free(sobj);
+	return threads;
+}
 
-	return NULL;
+static void bench_free_threads(struct bench_thread *threads, int nr)
+{
+	int i;
+
+	for(i = 0; i < nr; i++){
+		free(threads[i].lat);
+	}
 
+	free(threads);
 }
 
-void recieve_end(struct clist_controller *clist_ctl)
+/*
+	1つのキューについてベンチマークを実行してJSONを書く関数
+	return 成功：0（全オブジェクトが順番通りに届いた）　失敗：1
+*/
+static int bench_run(struct bench *b, const struct bench_queue *queue)
 {
-	int nr_wcurr, nr_picked, i, grain;
-	struct sample_object *sobj;
+	int i, n, ret;
+	char *buf;
+	double sec;
+	unsigned long long start, end, received = 0, sent = 0;
+	unsigned long long calls = 0, full = 0, cold = 0, bad = 0;
+
+	b->queue = queue;
+	b->producers_done = 0;
+
+	if((ret = queue->setup(b)) < 0){
+		fprintf(stderr, "%s: setup failed: %s\n", queue->name, strerror(-ret));
+		return 1;
+	}
+
+	b->producers = bench_threads(b, b->nr_producer);
+	b->consumers = bench_threads(b, b->nr_consumer);
+	b->next_seq = calloc(b->nr_producer, sizeof(*b->next_seq));
 
-	nr_wcurr = clist_set_end(clist_ctl, NULL, NULL);
+	if(b->producers == NULL || b->consumers == NULL || b->next_seq == NULL){
+		fprintf(stderr, "%s: out of memory\n", queue->name);
+		return 1;
+	}
 
-#ifdef DEBUG
-	printf("recieve_end() nr_wcurr:%d\n", nr_wcurr);
-#endif
+	pthread_barrier_init(&b->start, NULL, b->nr_producer + b->nr_consumer + 1);
 
-	/* clist_pull_end()でpull残しがないように大きい方でメモリを確保 */
-	if(nr_wcurr >= RECV_GRAIN_SIZE){
-		grain = nr_wcurr;
+	for(i = 0; i < b->nr_producer; i++){
+		pthread_create(&b->producers[i].tid, NULL, bench_producer, &b->producers[i]);
 	}
-	else{
-		grain = RECV_GRAIN_SIZE;
+	for(i = 0; i < b->nr_consumer; i++){
+		pthread_create(&b->consumers[i].tid, NULL, bench_consumer, &b->consumers[i]);
 	}
 
-	sobj = calloc(grain, sizeof(struct sample_object));
+	pthread_barrier_wait(&b->start);
+	start = bench_now_ns();
 
-	while(1){
-		nr_picked = clist_pull_order((void *)sobj, grain, clist_ctl);
-
-		if(nr_picked == 0){
-			puts("clist_pull_order() done, Now clist_pull_end()");
-			nr_picked = clist_pull_end((void *)sobj, clist_ctl);
-#ifdef DEBUG
-			for(i = 0; i < nr_picked; i++){
-				printf("\t##sobj[%d].id_no:%llu\n", i, sobj[i].id_no);
-			}
-			puts("\t*****");
-#endif
-			break;
-		}
-		else{
-#ifdef DEBUG
-			for(i = 0; i < nr_picked; i++){
-				printf("\t#sobj[%d].id_no:%llu\n", i, sobj[i].id_no);
-			}
-			puts("\t*****");
-#endif
+	for(i = 0; i < b->nr_producer; i++){
+		pthread_join(b->producers[i].tid, NULL);
+	}
+
+	__atomic_store_n(&b->producers_done, 1, __ATOMIC_RELEASE);
+
+	for(i = 0; i < b->nr_consumer; i++){
+		pthread_join(b->consumers[i].tid, NULL);
+	}
+
+	/* 書き込み中のノードに残った分を読む（消費者0番が読んだことにする） */
+	if(queue->drain){
+		buf = calloc(b->nr_composed > b->pull_batch ? b->nr_composed : b->pull_batch, b->object_size);
+
+		while((n = queue->drain(b, buf, b->pull_batch)) > 0){
+			bench_check(&b->consumers[0], buf, n);
 		}
+
+		free(buf);
 	}
 
-	free(sobj);
-}
+	end = bench_now_ns();
+	sec = (end - start) / 1e9;
 
+	for(i = 0; i < b->nr_producer; i++){
+		sent += b->producers[i].objects;
+		calls += b->producers[i].calls;
+		full += b->producers[i].full_events;
+	}
+	for(i = 0; i < b->nr_consumer; i++){
+		received += b->consumers[i].objects;
+		bad += b->consumers[i].bad_order;
+	}
 
-#define RBUF_NR_STEP			8
-#define RBUF_NR_STEP_COMPOSED	6
+	if(queue->cold_transitions){
+		cold = queue->cold_transitions(b);
+	}
 
-int main(int argc, char *argv[])
-{
-	int signo;
-	struct clist_controller *clist_ctl;
-	pthread_t send, recv;
-	sigset_t ss;
+	printf("{\"queue\":\"%s\",\"nr_node\":%d,\"nr_composed\":%d,\"object_size\":%d,"
+		"\"push_batch\":%d,\"pull_batch\":%d,\"api\":\"%s\",\"producers\":%d,\"consumers\":%d,\"pinned\":%s,",
+		queue->name, b->nr_node, b->nr_composed, b->object_size,
+		b->push_batch, b->pull_batch, b->api == BENCH_API_ONE ? "one" : b->api == BENCH_API_IOV ? "iov" : "order",
+		b->nr_producer, b->nr_consumer, b->pin ? "true" : "false");
+	printf("\"sent\":%llu,\"received\":%llu,\"bad_order\":%llu,\"seconds\":%.6f,"
+		"\"ops_per_sec\":%.0f,\"bytes_per_sec\":%.0f,\"push_calls\":%llu,"
+		"\"full_events\":%llu,\"full_events_per_sec\":%.0f,\"cold_transitions\":%llu,",
+		sent, received, bad, sec,
+		received / sec, received * (double)b->object_size / sec, calls,
+		full, full / sec, cold);
+	bench_print_latency("push_latency_ns", b->producers, b->nr_producer);
+	printf(",");
+	bench_print_latency("pull_latency_ns", b->consumers, b->nr_consumer);
+
+	if(queue->report){
+		queue->report(b);
+	}
 
-	clist_ctl = clist_alloc(RBUF_NR_STEP, RBUF_NR_STEP_COMPOSED, sizeof(struct sample_object));
+	printf("}");
 
-	pthread_create(&send , NULL , send_worker , (void *)clist_ctl);
-	pthread_create(&recv , NULL , recieve_worker , (void *)clist_ctl);
+	pthread_barrier_destroy(&b->start);
+	bench_free_threads(b->producers, b->nr_producer);
+	bench_free_threads(b->consumers, b->nr_consumer);
+	free(b->next_seq);
+	queue->teardown(b);
 
-	/* シグナルハンドリングの準備 */
-	sigemptyset(&ss);
-	/* block SIGTERM */
-	sigaddset(&ss, SIGTERM);
+	return (received == sent && bad == 0) ? 0 : 1;
+}
 
-	sigprocmask(SIG_BLOCK, &ss, NULL);
+static void bench_usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-n nr_node] [-c nr_composed] [-s object_size] [-b push_batch] [-B pull_batch]\n"
+		"\t[-a one|order|iov] [-p producers] [-C consumers] [-N objects_per_producer]\n"
+		"\t[-l latency_stride] [-q clist|mutex|all] [-M auto|memcpy|stream] [-I] [-F flush_us] [-A] [-R] [-T trace_file]\n", prog);
+}
 
-	/* シグナルが届くまでmainスレッドは無限ループ */
-	while(1){
-		if(sigwait(&ss, &signo) == 0){	/* シグナルが受信できたら */
-			if(signo == SIGTERM){
-				puts("main:sigterm recept");
-				death_flag = 1;
-				break;
+int main(int argc, char *argv[])
+{
+	int opt, i, ret = 0, first = 1;
+	const char *queue = "all", *trace = NULL;
+	FILE *fp;
+	struct bench b;
+
+	memset(&b, 0, sizeof(b));
+	b.nr_node = BENCH_NR_NODE;
+	b.nr_composed = BENCH_NR_COMPOSED;
+	b.object_size = BENCH_OBJECT_SIZE;
+	b.push_batch = BENCH_PUSH_BATCH;
+	b.pull_batch = BENCH_PULL_BATCH;
+	b.api = BENCH_API_ORDER;
+	b.nr_producer = 1;
+	b.nr_consumer = 1;
+	b.nr_objects = BENCH_NR_OBJECTS;
+	b.lat_stride = BENCH_LAT_STRIDE;
+
+	while((opt = getopt(argc, argv, "n:c:s:b:B:a:p:C:N:l:q:M:IF:ART:h")) != -1){
+		switch(opt){
+		case 'n': b.nr_node = atoi(optarg); break;
+		case 'c': b.nr_composed = atoi(optarg); break;
+		case 's': b.object_size = atoi(optarg); break;
+		case 'b': b.push_batch = atoi(optarg); break;
+		case 'B': b.pull_batch = atoi(optarg); break;
+		case 'a':
+			if(strcmp(optarg, "one") == 0){
+				b.api = BENCH_API_ONE;
+			}
+			else if(strcmp(optarg, "iov") == 0){
+				b.api = BENCH_API_IOV;
+			}
+			else{
+				b.api = BENCH_API_ORDER;
+			}
+			break;
+		case 'p': b.nr_producer = atoi(optarg); break;
+		case 'C': b.nr_consumer = atoi(optarg); break;
+		case 'N': b.nr_objects = strtoull(optarg, NULL, 0); break;
+		case 'l': b.lat_stride = atoi(optarg); break;
+		case 'q': queue = optarg; break;
+		case 'M':
+			if(strcmp(optarg, "memcpy") == 0){
+				b.copy_policy = CLIST_COPY_MEMCPY;
+			}
+			else if(strcmp(optarg, "stream") == 0){
+				b.copy_policy = CLIST_COPY_STREAM;
+			}
+			else{
+				b.copy_policy = CLIST_COPY_AUTO;
 			}
+			break;
+		case 'I': b.index = 1; break;
+		case 'F': b.flush_us = atoi(optarg); break;
+		case 'A': b.pin = 1; break;
+		case 'R': b.residence = 1; break;
+		case 'T': trace = optarg; break;
+		default:
+			bench_usage(argv[0]);
+			return 2;
 		}
 	}
 
-	/* kill -s SIGTERM 'this program PID'でここにくる */
+	if(b.nr_node < 2 || b.nr_composed < 1 || b.object_size < (int)sizeof(unsigned long long)
+		|| b.push_batch < 1 || b.pull_batch < 1 || b.nr_producer < 1 || b.nr_producer > 0xffff
+		|| b.nr_consumer < 1 || b.lat_stride < 1 || b.nr_objects >= (1ULL << 48)){
+		bench_usage(argv[0]);
+		return 2;
+	}
+
+	pthread_mutex_init(&b.pull_lock, NULL);
 
-	pthread_join(send, NULL);
-	pthread_join(recv, NULL);
+	printf("[");
 
-	recieve_end(clist_ctl);
+	for(i = 0; i < (int)(sizeof(bench_queues) / sizeof(bench_queues[0])); i++){
+		if(strcmp(queue, "all") != 0 && strcmp(queue, bench_queues[i].name) != 0){
+			continue;
+		}
 
-	clist_free(clist_ctl);
+		if(!first){
+			printf(",\n");
+		}
+		first = 0;
 
-	/* ベンチマーク結果を出力 */
-	puts("------------ベンチマーク結果---------------");
-	printf("入出力オブジェクト総数：%d\n", count);
-	printf("循環リストの総回転数：%d\n", count / (RBUF_NR_STEP * RBUF_NR_STEP_COMPOSED));
-	printf("データのpushをリトライした回数：%d\n", spilled);
+		ret |= bench_run(&b, &bench_queues[i]);
+		fflush(stdout);
+	}
 
-	return 0;
-}
+	printf("]\n");
 
+	if(trace){	/* 全スレッドが終わってから書き出す */
+		if((fp = fopen(trace, "w")) == NULL){
+			perror(trace);
+			ret = 1;
+		}
+		else{
+			if(clist_trace_dump(fp) == -EOPNOTSUPP){
+				fprintf(stderr, "trace: not built with -DCLIST_TRACE (use make trace)\n");
+			}
+			fclose(fp);
+		}
+	}
+
+	pthread_mutex_destroy(&b.pull_lock);
+
+	return ret;
+}
@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sched.h>	/* sched_yield() */
+#include <time.h>	/* clock_gettime() */
+#include "clist.h"	/* clist.cを-DCLIST_KSIMでビルドしたclist_kcore.oとリンクする */
+
+/*
+	カーネル版の循環リスト（clist.cをカーネルと同じ機能だけでビルドしたもの）をpthreadで動かして、
+	pushとpullの1回あたりの時間と、満杯/空で待った回数を測るベンチマーク
+	（カーネル版にはfutex/eventfdもSIMDのコピーも無いので、ユーザ空間版のclist_benchmarkとは別に測る）
+
+	使い方：clist_kbench [段数] [1段のオブジェクト数] [総オブジェクト数] [1回にpush/pullする数]
+*/
+
+#define KBENCH_NR_NODE		8
+#define KBENCH_NR_COMPOSED	64
+#define KBENCH_NR_OBJECTS	10000000UL
+#define KBENCH_GRAIN_SIZE	8
+
+struct sample_object{
+	unsigned long long id_no;
+	char padding[24];	/* 合計で32バイトになるように */
+};
+
+struct kbench{
+	struct clist_controller *clist_ctl;
+	unsigned long nr_objects;
+	int grain;
+
+	int done;	/* 生産者が全部pushし終わったら1 */
+
+	unsigned long push_calls, full_waits;
+	unsigned long pull_calls, empty_waits;
+	unsigned long received, bad_order;
+};
+
+/*
+	経過時間をナノ秒で返す関数
+*/
+static double kbench_elapsed_ns(const struct timespec *start, const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+/*
+	循環リストにデータをpushするスレッド
+	満杯で要求した分を全部は書けなかったら、残りは次の呼び出しで書く
+*/
+static void *kbench_send_worker(void *p)
+{
+	int i, n, ret;
+	unsigned long sent = 0;
+	struct kbench *kb;
+	struct sample_object *sobj;
+
+	kb = (struct kbench *)p;
+	sobj = calloc(kb->grain, sizeof(struct sample_object));
+
+	while(sent < kb->nr_objects){
+		n = kb->grain;
+
+		if(kb->nr_objects - sent < (unsigned long)n){
+			n = (int)(kb->nr_objects - sent);
+		}
+
+		for(i = 0; i < n; i++){
+			sobj[i].id_no = sent + i;
+		}
+
+		ret = clist_push_order((void *)sobj, n, kb->clist_ctl);
+		kb->push_calls++;
+
+		if(ret > 0){
+			sent += ret;
+		}
+
+		if(ret < n){
+			kb->full_waits++;
+			sched_yield();
+		}
+	}
+
+	free(sobj);
+
+	__atomic_store_n(&kb->done, 1, __ATOMIC_RELEASE);
+
+	return NULL;
+}
+
+/*
+	受け取ったオブジェクトの順番を確かめる関数
+*/
+static void kbench_check(struct kbench *kb, const struct sample_object *sobj, int n)
+{
+	int i;
+
+	for(i = 0; i < n; i++){
+		if(sobj[i].id_no != kb->received){
+			kb->bad_order++;
+		}
+
+		kb->received++;
+	}
+}
+
+/*
+	循環リストからデータを回収するスレッド
+	生産者が終わったらclist_set_end()で書き込み中のノードまで読み切る
+*/
+static void *kbench_recieve_worker(void *p)
+{
+	int n;
+	struct kbench *kb;
+	struct sample_object *sobj;
+
+	kb = (struct kbench *)p;
+	sobj = calloc(kb->clist_ctl->nr_composed > kb->grain ? kb->clist_ctl->nr_composed : kb->grain, sizeof(struct sample_object));
+
+	while(1){
+		n = clist_pull_order((void *)sobj, kb->grain, kb->clist_ctl);
+		kb->pull_calls++;
+
+		if(n > 0){
+			kbench_check(kb, sobj, n);
+			continue;
+		}
+
+		if(__atomic_load_n(&kb->done, __ATOMIC_ACQUIRE)){
+			break;
+		}
+
+		kb->empty_waits++;
+		sched_yield();
+	}
+
+	/* 生産者は止まっているので、完成したノードの読み残しと書き込み中のノードを読む */
+	clist_set_end(kb->clist_ctl, NULL, NULL);
+
+	while((n = clist_pull_order((void *)sobj, kb->grain, kb->clist_ctl)) > 0){
+		kbench_check(kb, sobj, n);
+	}
+
+	n = clist_pull_end((void *)sobj, kb->clist_ctl);
+
+	if(n > 0){
+		kbench_check(kb, sobj, n);
+	}
+
+	free(sobj);
+
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	int nr_node = KBENCH_NR_NODE, nr_composed = KBENCH_NR_COMPOSED;
+	double ns;
+	struct kbench kb = { 0 };
+	struct timespec start, end;
+	pthread_t send, recv;
+
+	kb.nr_objects = KBENCH_NR_OBJECTS;
+	kb.grain = KBENCH_GRAIN_SIZE;
+
+	if(argc > 1){
+		nr_node = atoi(argv[1]);
+	}
+	if(argc > 2){
+		nr_composed = atoi(argv[2]);
+	}
+	if(argc > 3){
+		kb.nr_objects = strtoul(argv[3], NULL, 0);
+	}
+	if(argc > 4){
+		kb.grain = atoi(argv[4]);
+	}
+
+	if(nr_node < 2 || nr_composed < 1 || kb.grain < 1 || kb.grain >= (nr_node - 1) * nr_composed){
+		fprintf(stderr, "usage: %s [nr_node(>=2)] [nr_composed] [nr_objects] [grain(< (nr_node-1)*nr_composed)]\n", argv[0]);
+		return 1;
+	}
+
+	kb.clist_ctl = clist_alloc(nr_node, nr_composed, sizeof(struct sample_object));
+
+	if(kb.clist_ctl == NULL){
+		perror("clist_alloc");
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	pthread_create(&send, NULL, kbench_send_worker, (void *)&kb);
+	pthread_create(&recv, NULL, kbench_recieve_worker, (void *)&kb);
+
+	pthread_join(send, NULL);
+	pthread_join(recv, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	clist_free(kb.clist_ctl);
+
+	ns = kbench_elapsed_ns(&start, &end);
+
+	/* ベンチマーク結果を出力 */
+	puts("------------ベンチマーク結果（カーネル版）---------------");
+	printf("段数：%d　1段のオブジェクト数：%d　1回の入出力数：%d\n", nr_node, nr_composed, kb.grain);
+	printf("入出力オブジェクト総数：%lu（順番の狂い：%lu）\n", kb.received, kb.bad_order);
+	printf("経過時間：%.3f ms\n", ns / 1e6);
+	printf("1オブジェクトあたり：%.1f ns\n", ns / (kb.received ? kb.received : 1));
+	printf("push回数：%lu（1回あたり %.1f ns）　満杯で待った回数：%lu\n",
+		kb.push_calls, ns / (kb.push_calls ? kb.push_calls : 1), kb.full_waits);
+	printf("pull回数：%lu　空で待った回数：%lu\n", kb.pull_calls, kb.empty_waits);
+
+	return kb.received == kb.nr_objects && kb.bad_order == 0 ? 0 : 1;
+}
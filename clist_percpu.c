@@ -0,0 +1,206 @@
+#define _GNU_SOURCE	/* sched_getcpu() */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>	/* sysconf() */
+#include <sched.h>
+
+#include "clist.h"
+
+/***********************************
+*
+*	ライブラリ内部関数
+*
+************************************/
+
+/*
+	呼び出し元が動いているCPUの循環リストを返す関数
+	@pcl 管理用構造体のアドレス
+
+	sched_getcpu()の後で別のCPUに移ることがあるので、各循環リストはMPSCモードにしてある
+*/
+static inline struct clist_controller *clist_percpu_this(struct clist_percpu *pcl)
+{
+	int cpu;
+
+	cpu = sched_getcpu();
+
+	if(cpu < 0){	/* 取得できなければ0番を使う */
+		cpu = 0;
+	}
+
+	return pcl->shards[cpu % pcl->nr_cpu];
+}
+
+/***********************************
+*
+*		公開用関数
+*
+************************************/
+
+/*
+	CPUごとに循環リストを構築する関数
+	@nr_node 循環リストの段数
+	@nr_composed 循環リスト１段に含まれるオブジェクトの数
+	@object_size オブジェクトのサイズ（バイト）
+
+	return 成功:clist_percpuのアドレス 失敗:NULL
+*/
+struct clist_percpu *clist_percpu_alloc(int nr_node, int nr_composed, int object_size)
+{
+	int i;
+	struct clist_percpu *pcl;
+
+	pcl = (struct clist_percpu *)malloc(sizeof(struct clist_percpu));
+
+	if(pcl == NULL){	/* エラー */
+		return NULL;
+	}
+
+	pcl->nr_cpu = (int)sysconf(_SC_NPROCESSORS_CONF);
+
+	if(pcl->nr_cpu < 1){
+		pcl->nr_cpu = 1;
+	}
+
+	pcl->object_size = object_size;
+
+	pcl->shards = (struct clist_controller **)calloc(pcl->nr_cpu, sizeof(struct clist_controller *));
+
+	if(pcl->shards == NULL){	/* エラー */
+		free(pcl);
+		return NULL;
+	}
+
+	for(i = 0; i < pcl->nr_cpu; i++){
+		pcl->shards[i] = clist_alloc(nr_node, nr_composed, object_size);
+
+		if(pcl->shards[i] == NULL){	/* エラー */
+			clist_percpu_free(pcl);
+			return NULL;
+		}
+
+		if(clist_set_mode(pcl->shards[i], CLIST_MODE_MPSC) < 0){	/* MPSCにできなければ使えない（別のCPUに移った生産者と並行に書くため） */
+			clist_percpu_free(pcl);
+			return NULL;
+		}
+	}
+
+	return pcl;
+}
+
+/*
+	メモリを解放する関数
+	@pcl clist_percpu_alloc()で確保した構造体のアドレス
+*/
+void clist_percpu_free(struct clist_percpu *pcl)
+{
+	int i;
+
+	for(i = 0; i < pcl->nr_cpu; i++){
+		if(pcl->shards[i]){
+			clist_free(pcl->shards[i]);
+		}
+	}
+
+	free(pcl->shards);
+	free(pcl);
+}
+
+/*
+	呼び出し元のCPUの循環リストに1オブジェクトだけデータを追加する関数
+	@data データが入っているアドレス
+	@pcl 管理用構造体のアドレス
+	return 成功：1　失敗：マイナスのエラーコード、もしくは0
+*/
+int clist_percpu_push_one(const void *data, struct clist_percpu *pcl)
+{
+	return clist_push_one(data, clist_percpu_this(pcl));
+}
+
+/*
+	呼び出し元のCPUの循環リストにデータを追加する関数
+	@data データが入っているアドレス
+	@n オブジェクトの個数
+	@pcl 管理用構造体のアドレス
+	return 成功：追加したオブジェクトの個数　失敗：マイナスのエラーコード
+*/
+int clist_percpu_push_order(const void *data, int n, struct clist_percpu *pcl)
+{
+	return clist_push_order(data, n, clist_percpu_this(pcl));
+}
+
+/*
+	全CPUの循環リストからデータを読む関数
+	@data データを格納するアドレス
+	@n 読み込む最大オブジェクト数
+	@key オブジェクトの並び順を決める値（タイムスタンプなど）を返す関数（任意）
+	@pcl 管理用構造体のアドレス
+	return dataに格納したオブジェクトの個数
+
+	keyがNULLならCPU順に読めるだけ読む
+	keyを指定すると各循環リストの先頭をk-wayマージして、keyの小さい順に並べて格納する
+	（各CPUの中ではkeyが単調増加していること 書き込み中のノードはどちらの場合も読まない）
+*/
+int clist_percpu_drain(void *data, int n, unsigned long long (*key)(const void *object), struct clist_percpu *pcl)
+{
+	int i, ret = 0, min_cpu, nr_peek, run;
+	unsigned long long k, min_key, next_key;
+	const void *head, *ptr;
+
+	if(key == NULL){
+		for(i = 0; i < pcl->nr_cpu && ret < n; i++){
+			ret += clist_pull_order(data + (size_t)ret * pcl->object_size, n - ret, pcl->shards[i]);
+		}
+
+		return ret;
+	}
+
+	while(ret < n){
+		min_cpu = -1;
+		min_key = 0;
+		next_key = ~0ULL;
+
+		/* 先頭のkeyが一番小さい循環リストと、二番目に小さいkeyを探す */
+		for(i = 0; i < pcl->nr_cpu; i++){
+			if(clist_pull_peek(pcl->shards[i], &head, NULL) == 0){
+				continue;
+			}
+
+			k = key(head);
+
+			if(min_cpu < 0 || k < min_key){
+				if(min_cpu >= 0){
+					next_key = min_key;
+				}
+				min_cpu = i;
+				min_key = k;
+			}
+			else if(k < next_key){
+				next_key = k;
+			}
+		}
+
+		if(min_cpu < 0){	/* どの循環リストにも読めるデータが無い */
+			break;
+		}
+
+		/* 二番目のkeyを超えるまでは同じ循環リストから続けて読む */
+		nr_peek = clist_pull_peek(pcl->shards[min_cpu], &head, NULL);
+
+		for(run = 0; run < nr_peek && ret + run < n; run++){
+			ptr = head + (size_t)run * pcl->object_size;
+
+			if(run > 0 && key(ptr) > next_key){
+				break;
+			}
+		}
+
+		memcpy(data + (size_t)ret * pcl->object_size, head, (size_t)run * pcl->object_size);
+		clist_pull_release(pcl->shards[min_cpu], run);
+
+		ret += run;
+	}
+
+	return ret;
+}
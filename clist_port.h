@@ -0,0 +1,112 @@
+#ifndef CLIST_PORT_H
+#define CLIST_PORT_H
+
+/*
+	循環リストのコア（clist.c）をカーネルとユーザ空間の両方でビルドするための移植レイヤ
+	メモリの確保/解放、時刻、ページの返却、待つ間のCPUの譲り方だけをここで切り替える
+	（ロックは使わず、バリアはclist.hのアトミック操作をそのまま使う）
+
+	__KERNEL__が定義されていればカーネルのAPIを使い、CLIST_PORT_KERNELを定義する
+	CLIST_PORT_KERNELの時は、futex/eventfd/共有メモリ/ファイルディスクリプタを使う機能（ブロッキング版、epoll連携、
+	clist_alloc_shared()、ベクタ版、clist_pull_to_fd()）とSIMDのコピーをビルドしない
+
+	ユーザ空間で-DCLIST_KSIMを付けると、libcのままカーネル版と同じ機能だけでビルドする（clist_kbenchで測るため）
+
+	カーネルのツリーでは、clist.hをinclude/linux/に、clist.c、clist_trace.h、このファイルをlib/に置く
+	（make kernel-tree KDIR=...でkernel/のMakefile/Kconfigと一緒にコピーする）
+*/
+
+#ifdef __KERNEL__
+
+#include <linux/kernel.h>	/* INT_MAX */
+#include <linux/types.h>	/* uint64_t, uintptr_t */
+#include <linux/string.h>	/* memcpy */
+#include <linux/errno.h>
+#include <linux/slab.h>	/* kzalloc */
+#include <linux/vmalloc.h>	/* vmalloc */
+#include <linux/mm.h>	/* PAGE_SIZE */
+#include <linux/cpumask.h>	/* num_online_cpus() */
+#include <linux/ktime.h>	/* ktime_get() */
+#include <linux/module.h>	/* EXPORT_SYMBOL */
+#include <asm/processor.h>	/* cpu_relax() */
+
+#define CLIST_PORT_KERNEL
+
+#define clist_zalloc(size)	kzalloc(size, GFP_KERNEL)
+#define clist_mfree(p)	kfree(p)
+
+/* vmallocはページ境界に揃うので、ページ以下のalignは必ず満たす */
+#define clist_aligned_alloc(align, size)	vmalloc(size)
+#define clist_aligned_free(p)	vfree(p)
+
+#define clist_page_size()	((size_t)PAGE_SIZE)
+#define clist_discard_pages(addr, len)	do{ }while(0)	/* vmallocの領域はページを返さない（clist_shrink()はノードを外すだけ） */
+#define clist_online_cpus()	num_online_cpus()
+#define clist_cpu_relax()	cpu_relax()
+
+/*
+	現在時刻（単調増加、ナノ秒）を返す関数
+*/
+static inline long long clist_now_ns(void)
+{
+	return ktime_to_ns(ktime_get());
+}
+
+#else	/* ユーザ空間 */
+
+#include <stdlib.h>
+#include <string.h>	/* memcpy */
+#include <errno.h>
+#include <limits.h>	/* INT_MAX */
+#include <stdint.h>	/* uint64_t, uintptr_t */
+#include <time.h>	/* clock_gettime() */
+#include <sched.h>	/* sched_yield() */
+#include <unistd.h>	/* sysconf() */
+#include <sys/mman.h>	/* madvise() */
+
+#ifdef CLIST_KSIM
+#define CLIST_PORT_KERNEL	/* カーネル版と同じ機能だけでビルドする */
+#endif
+
+#define clist_zalloc(size)	calloc(1, size)
+#define clist_mfree(p)	free(p)
+
+/*
+	alignバイト境界に揃えてメモリを確保する関数（中身は初期化しない）
+	return 成功:確保した領域 失敗:NULL
+*/
+static inline void *clist_aligned_alloc(size_t align, size_t size)
+{
+	void *p;
+
+	if(posix_memalign(&p, align, size) != 0){
+		return NULL;
+	}
+
+	return p;
+}
+
+#define clist_aligned_free(p)	free(p)
+
+#define clist_page_size()	((size_t)sysconf(_SC_PAGESIZE))
+#define clist_discard_pages(addr, len)	madvise(addr, len, MADV_DONTNEED)
+#define clist_online_cpus()	((int)sysconf(_SC_NPROCESSORS_ONLN))
+#define clist_cpu_relax()	sched_yield()
+
+/*
+	現在時刻（CLOCK_MONOTONIC、ナノ秒）を返す関数
+*/
+static inline long long clist_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+#define EXPORT_SYMBOL(sym)
+
+#endif	/* __KERNEL__ */
+
+#endif	/* CLIST_PORT_H */
@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>	/* clock_gettime() */
+#if defined(__x86_64__)
+#include <x86intrin.h>	/* __rdtsc() */
+#endif
+
+#include "clist_trace.h"
+
+#ifdef CLIST_TRACE
+
+/***********************************
+*
+*	ライブラリ内部関数
+*
+************************************/
+
+/* スレッドごとのイベントのバッファ（スレッドが終わっても解放せず、clist_trace_dump()で読めるように残す） */
+struct clist_trace_buf{
+	struct clist_trace_buf *next;	/* 前に作られたバッファ */
+	int id;		/* 作られた順の番号 */
+	unsigned long long head;	/* 書いたイベントの累計 */
+	struct clist_trace_event ev[CLIST_TRACE_BUF_SIZE];
+};
+
+static struct clist_trace_buf *clist_trace_bufs;	/* 全スレッドのバッファ（最後に作ったものが先頭） */
+static int clist_trace_nr_bufs;
+static __thread struct clist_trace_buf *clist_trace_local;
+
+/*
+	時刻を返す関数（x86ではTSCを読むだけなので、clock_gettime()より安い）
+*/
+static inline unsigned long long clist_trace_stamp(void)
+{
+#if defined(__x86_64__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/*
+	呼び出し元のスレッドのバッファを作ってリストにつなぐ関数
+	return 成功:バッファ 失敗:NULL
+*/
+static struct clist_trace_buf *clist_trace_buf_alloc(void)
+{
+	struct clist_trace_buf *buf;
+
+	buf = calloc(1, sizeof(struct clist_trace_buf));
+
+	if(buf == NULL){
+		return NULL;
+	}
+
+	buf->id = __atomic_add_fetch(&clist_trace_nr_bufs, 1, __ATOMIC_RELAXED);
+	buf->next = __atomic_load_n(&clist_trace_bufs, __ATOMIC_RELAXED);
+
+	while(!__atomic_compare_exchange_n(&clist_trace_bufs, &buf->next, buf, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)){
+		;	/* 他のスレッドが先につないだらやり直す */
+	}
+
+	return buf;
+}
+
+/***********************************
+*
+*		公開用関数
+*
+************************************/
+
+/*
+	イベントを1つ記録する関数（clist_trace()から呼ぶ）
+	@type CLIST_TRACE_*
+	@clist_ctl 管理構造体のアドレス
+	@a, @b イベントごとの値
+
+	呼び出し元のスレッドのバッファにしか書かないのでロックもアトミック操作も要らない
+*/
+void clist_trace_record(int type, const void *clist_ctl, int a, int b)
+{
+	struct clist_trace_buf *buf;
+	struct clist_trace_event *ev;
+
+	buf = clist_trace_local;
+
+	if(buf == NULL){
+		buf = clist_trace_local = clist_trace_buf_alloc();
+
+		if(buf == NULL){
+			return;	/* 記録できなくても循環リストの動作には影響させない */
+		}
+	}
+
+	ev = &buf->ev[buf->head & (CLIST_TRACE_BUF_SIZE - 1)];
+	ev->stamp = clist_trace_stamp();
+	ev->clist_ctl = clist_ctl;
+	ev->type = type;
+	ev->a = a;
+	ev->b = b;
+
+	__atomic_store_n(&buf->head, buf->head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+	トレースのバッファを全スレッド分まとめて出力する関数
+	@fp 出力先
+	return 出力したイベントの数
+
+	1行に「スレッドの番号 時刻 管理構造体のアドレス イベント名 a b」を書く
+*/
+int clist_trace_dump(FILE *fp)
+{
+	static const char *names[] = { "?", "push", "pull", "full", "hot", "empty", "end", "flush" };
+	int count = 0;
+	unsigned long long i, head, start;
+	struct clist_trace_buf *buf;
+	struct clist_trace_event *ev;
+
+	for(buf = __atomic_load_n(&clist_trace_bufs, __ATOMIC_ACQUIRE); buf; buf = buf->next){
+		head = __atomic_load_n(&buf->head, __ATOMIC_ACQUIRE);
+		start = head > CLIST_TRACE_BUF_SIZE ? head - CLIST_TRACE_BUF_SIZE : 0;
+
+		for(i = start; i < head; i++){
+			ev = &buf->ev[i & (CLIST_TRACE_BUF_SIZE - 1)];
+
+			fprintf(fp, "%d %llu %p %s %d %d\n", buf->id, ev->stamp, ev->clist_ctl,
+				(ev->type > 0 && ev->type <= CLIST_TRACE_FLUSH) ? names[ev->type] : names[0], ev->a, ev->b);
+			count++;
+		}
+	}
+
+	return count;
+}
+
+#else	/* CLIST_TRACE */
+
+/*
+	トレースポイントをビルドしていない時のclist_trace_dump()
+*/
+int clist_trace_dump(FILE *fp)
+{
+	return -EOPNOTSUPP;	/* トレースポイントをビルドしていない */
+}
+
+#endif	/* CLIST_TRACE */
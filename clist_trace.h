@@ -0,0 +1,69 @@
+#ifndef CLIST_TRACE_H
+#define CLIST_TRACE_H
+
+#ifndef __KERNEL__
+#include <stdio.h>
+#endif
+
+/*
+	循環リストのトレースポイント
+	-DCLIST_TRACE を付けてビルドした時だけ有効になり、付けなければclist_trace()は何も生成しない
+
+	有効な時はスレッドごとのバッファに固定長のイベントを書くだけで、整形はclist_trace_dump()でまとめて行う
+	<sys/sdt.h>があればUSDTプローブ（provider:clist）も置くので、perf/bpftraceからも拾える
+*/
+
+/* イベントの種類（a, bの意味） */
+#define CLIST_TRACE_PUSH	1	/* push（a:要求したオブジェクト数 b:戻り値） */
+#define CLIST_TRACE_PULL	2	/* pull（a:要求したオブジェクト数 b:戻り値） */
+#define CLIST_TRACE_FULL	3	/* 満杯でHOTからCOLDになった（a:pull待ちのノード数） */
+#define CLIST_TRACE_HOT	4	/* COLDからHOTに戻った（a:1なら消費者、0なら生産者が戻した） */
+#define CLIST_TRACE_EMPTY	5	/* pullしたが読めるものが無かった（a:要求したオブジェクト数） */
+#define CLIST_TRACE_END	6	/* END状態になった（a:書き込み中のノードに残っているオブジェクト数） */
+#define CLIST_TRACE_FLUSH	7	/* 一杯になる前に封をした（a:封をしたバイト数 b:期限で封をしたなら1、期限切れで消費者が封をしたなら2） */
+
+#define CLIST_TRACE_BUF_SIZE	4096	/* スレッドごとに覚えておくイベントの数（2の累乗 超えたら古いものから上書き） */
+
+/* 1イベント（32バイト） */
+struct clist_trace_event{
+	unsigned long long stamp;	/* x86ではTSC、それ以外ではCLOCK_MONOTONICのナノ秒 */
+	const void *clist_ctl;
+	int type;	/* CLIST_TRACE_* */
+	int a, b;
+};
+
+/*
+	トレースのバッファを全スレッド分まとめて出力する関数
+	@fp 出力先
+	return 出力したイベントの数 CLIST_TRACEなしでビルドした時は-EOPNOTSUPP
+
+	書き込み中のスレッドがあるとそのイベントは途中の値で出ることがあるので、止めてから呼び出すこと
+*/
+#ifndef __KERNEL__	/* カーネル版はCLIST_TRACEなしでしかビルドしない */
+int clist_trace_dump(FILE *fp);
+#endif
+
+#ifdef CLIST_TRACE
+
+void clist_trace_record(int type, const void *clist_ctl, int a, int b);
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define CLIST_TRACE_USDT(type, ctl, a, b)	DTRACE_PROBE4(clist, event, type, ctl, a, b)
+#endif
+#endif
+
+#ifndef CLIST_TRACE_USDT
+#define CLIST_TRACE_USDT(type, ctl, a, b)	do{ }while(0)
+#endif
+
+#define clist_trace(type, ctl, a, b)	do{ CLIST_TRACE_USDT(type, ctl, a, b); clist_trace_record(type, ctl, a, b); }while(0)
+
+#else	/* CLIST_TRACE */
+
+#define clist_trace(type, ctl, a, b)	do{ (void)(ctl); (void)(a); (void)(b); }while(0)	/* 引数だけの変数を未使用にしない */
+
+#endif	/* CLIST_TRACE */
+
+#endif	/* CLIST_TRACE_H */
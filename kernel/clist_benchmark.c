@@ -50,6 +50,13 @@ static struct cdev c_dev; /* キャラクタデバイス用構造体 */
 static struct clist_controller *clist_ctl;
 static struct signal_spec sigspec;
 
+/*
+	clist_pull_end()で書き込み中のノードから取り出した分のうち、まだread(2)で返していないもの
+	end_mem:取り出した中身（無ければNULL）　end_pos:返し終わったオブジェクト数　end_left:残りのオブジェクト数
+*/
+static void *end_mem;
+static int end_pos, end_left;
+
 
 
 /**********************************************************
@@ -123,6 +130,11 @@ static int clbench_release(struct inode* inode, struct file* filp)
 		printk(KERN_INFO "%s : Warning sr_status isn't SIGRESET_ACCEPTED\n", log_prefix);
 	}
 
+	/* 読まれなかった残りを捨てる */
+	kfree(end_mem);
+	end_mem = NULL;
+	end_left = 0;
+
 	/* 循環リストを解放 */
 	clist_free(clist_ctl);
 
@@ -130,42 +142,110 @@ static int clbench_release(struct inode* inode, struct file* filp)
 	return 0;
 }
 
+/*
+	書き込みが完了したノードからユーザ空間に直接コピーする関数
+	@buf ユーザ空間のバッファ
+	@objects 読み込む最大オブジェクト数
+	return 成功：コピーしたオブジェクト数　失敗：マイナスのエラーコード
+
+	中間メモリを経由せず、clist_pull_peek()で参照したノードの中身をそのままcopy_to_user()する
+*/
+static int clbench_copy_nodes(char __user *buf, int objects)
+{
+	int nr_peek, actually_pulled = 0;
+	const void *ptr;
+
+	while(actually_pulled < objects){
+		nr_peek = clist_pull_peek(clist_ctl, &ptr, NULL);
+
+		if(nr_peek == 0){
+			break;
+		}
+
+		if(nr_peek > objects - actually_pulled){
+			nr_peek = objects - actually_pulled;
+		}
+
+		if(copy_to_user(buf + objs_to_byte(clist_ctl, actually_pulled), ptr, objs_to_byte(clist_ctl, nr_peek))){
+			return -EFAULT;
+		}
+
+		/* ユーザ空間へのコピーが終わってからノードを返す */
+		clist_pull_release(clist_ctl, nr_peek);
+		actually_pulled += nr_peek;
+	}
+
+	return actually_pulled;
+}
+
 /* read(2) */
 static ssize_t clbench_read(struct file* filp, char* buf, size_t count, loff_t* offset)
 {
-	int actually_pulled, objects, ret;
-	void *temp_mem;
+	int actually_pulled = 0, objects, ret;
 
 	if(sigspec.sr_status == SIG_READY || sigspec.sr_status == SIGRESET_REQUEST){
 
 		objects = count / sizeof(struct object);
 
-		/* 中間メモリを確保 */
-		temp_mem = (void *)kzalloc(count, GFP_KERNEL);
+		if(end_mem == NULL){
+			actually_pulled = clbench_copy_nodes(buf, objects);
+
+			if(actually_pulled < 0){
+				printk(KERN_WARNING "%s : copy_to_user failed\n", log_prefix);
+				return actually_pulled;
+			}
+
+			if(actually_pulled == 0 && CLIST_IS_END(clist_ctl)){	/* ここは1回しか通らないはず */
+				printk(KERN_INFO "%s : now, clist_pull_end() is calling\n", log_prefix);
+
+				/* 中間メモリを確保（countに入りきらなかった分は次のread(2)で返すので、返し終わるまで持っておく） */
+				end_mem = kzalloc(clist_ctl->node_len, GFP_KERNEL);
 
-		actually_pulled = clist_pull_order(temp_mem, objects, clist_ctl);
+				if(end_mem == NULL){
+					return -ENOMEM;
+				}
 
-		if(actually_pulled == 0 && CLIST_IS_END(clist_ctl)){	/* ここは1回しか通らないはず */
-			printk(KERN_INFO "%s : now, clist_pull_end() is calling\n", log_prefix);
+				/* もし1つも読めなくて、かつ循環リストがENDなら書き込み中のノードから読む */
+				end_left = clist_pull_end(end_mem, clist_ctl);
+				end_pos = 0;
 
-			/* もし1つも読めなくて、かつ循環リストがCOLDなら書き込み中のノードから読む */
-			actually_pulled = clist_pull_end(temp_mem, clist_ctl);
-			sigspec.sr_status = SIGRESET_ACCEPTED;
+				if(end_left < 0){
+					ret = end_left;
+					kfree(end_mem);
+					end_mem = NULL;
+					end_left = 0;
+					return ret;
+				}
+			}
 		}
 
-		/* pullしたバイト数を計算 */
-		ret = objs_to_byte(clist_ctl, actually_pulled);
+		if(end_mem){	/* 書き込み中のノードから取り出した分を返す */
+			if(objects == 0 && end_left > 0){
+				return -EINVAL;	/* 1オブジェクトも入らないバッファでは残りを返せない */
+			}
 
-		/* ユーザ空間にコピー */
-		if(copy_to_user(buf, temp_mem, ret)){
-			printk(KERN_WARNING "%s : copy_to_user failed\n", log_prefix);
-			return -EFAULT;
+			actually_pulled = (end_left < objects) ? end_left : objects;
+
+			/* ユーザ空間にコピー（失敗しても残りは次のread(2)で返せる） */
+			if(copy_to_user(buf, end_mem + objs_to_byte(clist_ctl, end_pos), objs_to_byte(clist_ctl, actually_pulled))){
+				printk(KERN_WARNING "%s : copy_to_user failed\n", log_prefix);
+				return -EFAULT;
+			}
+
+			end_pos += actually_pulled;
+			end_left -= actually_pulled;
+
+			if(end_left == 0){	/* 全部返し終わったので、これ以降のread(2)は0を返す */
+				kfree(end_mem);
+				end_mem = NULL;
+				sigspec.sr_status = SIGRESET_ACCEPTED;
+			}
 		}
 
-		printk(KERN_INFO "%s : count = %d, actually_pulled:%d, wlen:%d\n", log_prefix, (int)count, actually_pulled, clist_wlen(clist_ctl));
+		/* pullしたバイト数を計算 */
+		ret = objs_to_byte(clist_ctl, actually_pulled);
 
-		/* 中間メモリを解放 */
-		kfree(temp_mem);
+		printk(KERN_INFO "%s : count = %d, actually_pulled:%d, wlen:%d\n", log_prefix, (int)count, actually_pulled, clist_wlen(clist_ctl));
 
 		*offset += ret;
 	}
@@ -260,6 +340,7 @@ static long clbench_ioctl(struct file *flip, unsigned int cmd, unsigned long arg
 				retval = -ENOMEM;
 			}
 			else{
+				clist_set_mode(clist_ctl, CLIST_MODE_MPSC);	/* フック先は複数のCPUから同時にpushする */
 				mod_timer(&sigspec.flush_timer, jiffies + msecs_to_jiffies(sigspec.flush_period));
 				printk(KERN_INFO "%s : device setup complete\n", log_prefix);
 				retval = 1;
@@ -349,6 +430,8 @@ static void __exit clbench_exit(void)
 		clist_free(clist_ctl);
 	}
 
+	kfree(end_mem);
+
 	unregister_chrdev_region(dev_id, MINOR_COUNT);	/* メジャー番号の解放 */
 	printk(KERN_INFO "%s : clbench is removed\n", log_prefix);
 }